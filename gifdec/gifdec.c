@@ -13,9 +13,26 @@
 #include <unistd.h>
 #endif
 
+/* count allocations of each conversion only if asked to */
+#ifdef ALLOC_STATS
+#include "alloc.h"
+#endif
+
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
 
+/* count LZW internals only if asked to */
+#ifdef LZW_STATS
+#define STAT(x) (x)
+#else
+#define STAT(x) ((void) 0)
+#endif
+
+/* Longest LZW table, as codes are at most 12 bits */
+#define MAX_ENTRIES 0x1000
+
+static gd_GIF *open_gif(int fd, const uint8_t *data, size_t size, int flags, gd_Arena *arena);
+
 typedef struct Entry {
     uint16_t length;
     uint16_t prefix;
@@ -28,49 +45,177 @@ typedef struct Table {
     Entry *entries;
 } Table;
 
-static uint16_t
-read_num(int fd)
+struct gd_Arena {
+    gd_GIF *gif;
+    size_t gif_size;
+    Table *table;
+};
+
+/* Read from the file, or from memory if the GIF has no file. */
+static ssize_t
+gd_read(gd_GIF *gif, void *buf, size_t n)
+{
+    if (gif->fd != -1)
+        return read(gif->fd, buf, n);
+    if (gif->pos >= (off_t) gif->size)
+        return 0;
+    n = MIN(n, gif->size - gif->pos);
+    memcpy(buf, &gif->data[gif->pos], n);
+    gif->pos += n;
+    return n;
+}
+
+/* Seek in the file, or in memory if the GIF has no file. */
+static off_t
+gd_seek(gd_GIF *gif, off_t offset, int whence)
+{
+    if (gif->fd != -1)
+        return lseek(gif->fd, offset, whence);
+    if (whence == SEEK_CUR)
+        offset += gif->pos;
+    else if (whence == SEEK_END)
+        offset += gif->size;
+    if (offset < 0)
+        return -1;
+    gif->pos = offset;
+    return offset;
+}
+
+/* Read a little-endian 16-bit number.
+ * Return 0 on success or -1 if the GIF ends first, leaving *num zero. */
+static int
+read_num(gd_GIF *gif, uint16_t *num)
 {
-    uint8_t bytes[2];
+    uint8_t bytes[2] = {0, 0};
+    int ret;
 
-    read(fd, bytes, 2);
-    return bytes[0] + (((uint16_t) bytes[1]) << 8);
+    ret = gd_read(gif, bytes, 2) == 2 ? 0 : -1;
+    *num = ret ? 0 : bytes[0] + (((uint16_t) bytes[1]) << 8);
+    return ret;
 }
 
 gd_GIF *
 gd_open_gif(const char *fname)
+{
+    return gd_open_gif_flags(fname, 0);
+}
+
+gd_GIF *
+gd_open_gif_flags(const char *fname, int flags)
+{
+    return gd_open_gif_arena(fname, flags, NULL);
+}
+
+gd_GIF *
+gd_open_gif_arena(const char *fname, int flags, gd_Arena *arena)
 {
     int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1) return NULL;
+#ifdef _WIN32
+    setmode(fd, O_BINARY);
+#endif
+    return open_gif(fd, NULL, 0, flags, arena);
+}
+
+gd_GIF *
+gd_open_gif_fd(int fd, int flags)
+{
+    return open_gif(fd, NULL, 0, flags, NULL);
+}
+
+gd_GIF *
+gd_open_gif_mem(const uint8_t *data, size_t size, int flags)
+{
+    return open_gif(-1, data, size, flags, NULL);
+}
+
+gd_GIF *
+gd_open_gif_mem_arena(const uint8_t *data, size_t size, int flags, gd_Arena *arena)
+{
+    return open_gif(-1, data, size, flags, arena);
+}
+
+gd_Arena *
+gd_new_arena(void)
+{
+    gd_Arena *arena = calloc(1, sizeof(*arena));
+    if (!arena) return NULL;
+    arena->table = malloc(sizeof(Table) + sizeof(Entry) * MAX_ENTRIES);
+    if (!arena->table) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void
+gd_del_arena(gd_Arena *arena)
+{
+    if (!arena) return;
+    free(arena->gif);
+    free(arena->table);
+    free(arena);
+}
+
+/* Zeroed GIF with room for canvas and frame, from the arena if given. */
+static gd_GIF *
+new_gif(gd_Arena *arena, size_t gif_sz)
+{
+    gd_GIF *gif;
+
+    if (!arena)
+        return calloc(1, gif_sz);
+    if (gif_sz > arena->gif_size) {
+        free(arena->gif);
+        arena->gif = malloc(gif_sz);
+        arena->gif_size = arena->gif ? gif_sz : 0;
+        if (!arena->gif) return NULL;
+    }
+    gif = arena->gif;
+    memset(gif, 0, gif_sz);
+    gif->arena = arena;
+    return gif;
+}
+
+static gd_GIF *
+open_gif(int fd, const uint8_t *data, size_t size, int flags, gd_Arena *arena)
+{
+    gd_GIF head = {0};
     uint8_t sigver[3];
     uint16_t width, height, depth;
     uint8_t fdsz, bgidx, aspect;
     int i;
     uint8_t *bgcolor;
     int gct_sz;
-    gd_GIF *gif;
+    size_t canvas_sz, frame_sz;
+    gd_GIF *gif = NULL;
 
-    fd = open(fname, O_RDONLY);
-    if (fd == -1) return NULL;
-#ifdef _WIN32
-    setmode(fd, O_BINARY);
-#endif
+    head.fd = fd;
+    head.data = data;
+    head.size = size;
     /* Header */
-    read(fd, sigver, 3);
-    if (memcmp(sigver, "GIF", 3) != 0) {
+    if (gd_read(&head, sigver, 3) != 3 || memcmp(sigver, "GIF", 3) != 0) {
         fprintf(stderr, "invalid signature\n");
         goto fail;
     }
     /* Version */
-    read(fd, sigver, 3);
-    if (memcmp(sigver, "89a", 3) != 0) {
+    if (gd_read(&head, sigver, 3) != 3 || memcmp(sigver, "89a", 3) != 0) {
         fprintf(stderr, "invalid version\n");
         goto fail;
     }
     /* Width x Height */
-    width  = read_num(fd);
-    height = read_num(fd);
-    /* FDSZ */
-    read(fd, &fdsz, 1);
+    if (read_num(&head, &width) == -1 || read_num(&head, &height) == -1) {
+        fprintf(stderr, "truncated header\n");
+        goto fail;
+    }
+    /* FDSZ, Background Color Index and Aspect Ratio */
+    if (gd_read(&head, &fdsz, 1) != 1 || gd_read(&head, &bgidx, 1) != 1 ||
+        gd_read(&head, &aspect, 1) != 1) {
+        fprintf(stderr, "truncated header\n");
+        goto fail;
+    }
     /* Presence of GCT */
     if (!(fdsz & 0x80)) {
         fprintf(stderr, "no global color table\n");
@@ -81,34 +226,36 @@ gd_open_gif(const char *fname)
     /* Ignore Sort Flag. */
     /* GCT Size */
     gct_sz = 1 << ((fdsz & 0x07) + 1);
-    /* Background Color Index */
-    read(fd, &bgidx, 1);
-    /* Aspect Ratio */
-    read(fd, &aspect, 1);
     /* Create gd_GIF Structure. */
-    gif = calloc(1, sizeof(*gif) + 4 * width * height);
+    canvas_sz = (flags & (GD_NO_CANVAS | GD_NO_FRAME)) ? 0 : 3 * width * height;
+    frame_sz = (flags & GD_NO_FRAME) ? 0 : width * height;
+    gif = new_gif(arena, sizeof(*gif) + canvas_sz + frame_sz);
     if (!gif) goto fail;
     gif->fd = fd;
+    gif->data = data;
+    gif->size = size;
+    gif->pos = head.pos;
     gif->width  = width;
     gif->height = height;
     gif->depth  = depth;
     /* Read GCT */
     gif->gct.size = gct_sz;
-    read(fd, gif->gct.colors, 3 * gif->gct.size);
+    gd_read(gif, gif->gct.colors, 3 * gif->gct.size);
     gif->palette = &gif->gct;
     gif->bgindex = bgidx;
-    gif->canvas = (uint8_t *) &gif[1];
-    gif->frame = &gif->canvas[3 * width * height];
-    if (gif->bgindex)
+    gif->canvas = canvas_sz ? (uint8_t *) &gif[1] : NULL;
+    gif->frame = frame_sz ? &((uint8_t *) &gif[1])[canvas_sz] : NULL;
+    if (gif->frame && gif->bgindex)
         memset(gif->frame, gif->bgindex, gif->width * gif->height);
     bgcolor = &gif->palette->colors[gif->bgindex*3];
-    if (bgcolor[0] || bgcolor[1] || bgcolor [2])
+    if (gif->canvas && (bgcolor[0] || bgcolor[1] || bgcolor [2]))
         for (i = 0; i < gif->width * gif->height; i++)
             memcpy(&gif->canvas[i*3], bgcolor, 3);
-    gif->anim_start = lseek(fd, 0, SEEK_CUR);
+    gif->anim_start = gd_seek(gif, 0, SEEK_CUR);
     goto ok;
 fail:
-    close(fd);
+    if (fd != -1)
+        close(fd);
 ok:
     return gif;
 }
@@ -119,8 +266,9 @@ discard_sub_blocks(gd_GIF *gif)
     uint8_t size;
 
     do {
-        read(gif->fd, &size, 1);
-        lseek(gif->fd, size, SEEK_CUR);
+        if (gd_read(gif, &size, 1) != 1)
+            break;
+        gd_seek(gif, size, SEEK_CUR);
     } while (size);
 }
 
@@ -131,21 +279,19 @@ read_plain_text_ext(gd_GIF *gif)
         uint16_t tx, ty, tw, th;
         uint8_t cw, ch, fg, bg;
         off_t sub_block;
-        lseek(gif->fd, 1, SEEK_CUR); /* block size = 12 */
-        tx = read_num(gif->fd);
-        ty = read_num(gif->fd);
-        tw = read_num(gif->fd);
-        th = read_num(gif->fd);
-        read(gif->fd, &cw, 1);
-        read(gif->fd, &ch, 1);
-        read(gif->fd, &fg, 1);
-        read(gif->fd, &bg, 1);
-        sub_block = lseek(gif->fd, 0, SEEK_CUR);
+        gd_seek(gif, 1, SEEK_CUR); /* block size = 12 */
+        if (read_num(gif, &tx) == -1 || read_num(gif, &ty) == -1 ||
+            read_num(gif, &tw) == -1 || read_num(gif, &th) == -1)
+            return;
+        if (gd_read(gif, &cw, 1) != 1 || gd_read(gif, &ch, 1) != 1 ||
+            gd_read(gif, &fg, 1) != 1 || gd_read(gif, &bg, 1) != 1)
+            return;
+        sub_block = gd_seek(gif, 0, SEEK_CUR);
         gif->plain_text(gif, tx, ty, tw, th, cw, ch, fg, bg);
-        lseek(gif->fd, sub_block, SEEK_SET);
+        gd_seek(gif, sub_block, SEEK_SET);
     } else {
         /* Discard plain text metadata. */
-        lseek(gif->fd, 13, SEEK_CUR);
+        gd_seek(gif, 13, SEEK_CUR);
     }
     /* Discard plain text sub-blocks. */
     discard_sub_blocks(gif);
@@ -157,24 +303,24 @@ read_graphic_control_ext(gd_GIF *gif)
     uint8_t rdit;
 
     /* Discard block size (always 0x04). */
-    lseek(gif->fd, 1, SEEK_CUR);
-    read(gif->fd, &rdit, 1);
+    gd_seek(gif, 1, SEEK_CUR);
+    gd_read(gif, &rdit, 1);
     gif->gce.disposal = (rdit >> 2) & 3;
     gif->gce.input = rdit & 2;
     gif->gce.transparency = rdit & 1;
-    gif->gce.delay = read_num(gif->fd);
-    read(gif->fd, &gif->gce.tindex, 1);
+    read_num(gif, &gif->gce.delay);
+    gd_read(gif, &gif->gce.tindex, 1);
     /* Skip block terminator. */
-    lseek(gif->fd, 1, SEEK_CUR);
+    gd_seek(gif, 1, SEEK_CUR);
 }
 
 static void
 read_comment_ext(gd_GIF *gif)
 {
     if (gif->comment) {
-        off_t sub_block = lseek(gif->fd, 0, SEEK_CUR);
+        off_t sub_block = gd_seek(gif, 0, SEEK_CUR);
         gif->comment(gif);
-        lseek(gif->fd, sub_block, SEEK_SET);
+        gd_seek(gif, sub_block, SEEK_SET);
     }
     /* Discard comment sub-blocks. */
     discard_sub_blocks(gif);
@@ -187,21 +333,21 @@ read_application_ext(gd_GIF *gif)
     char app_auth_code[3];
 
     /* Discard block size (always 0x0B). */
-    lseek(gif->fd, 1, SEEK_CUR);
+    gd_seek(gif, 1, SEEK_CUR);
     /* Application Identifier. */
-    read(gif->fd, app_id, 8);
+    gd_read(gif, app_id, 8);
     /* Application Authentication Code. */
-    read(gif->fd, app_auth_code, 3);
+    gd_read(gif, app_auth_code, 3);
     if (!strncmp(app_id, "NETSCAPE", sizeof(app_id))) {
         /* Discard block size (0x03) and constant byte (0x01). */
-        lseek(gif->fd, 2, SEEK_CUR);
-        gif->loop_count = read_num(gif->fd);
+        gd_seek(gif, 2, SEEK_CUR);
+        read_num(gif, &gif->loop_count);
         /* Skip block terminator. */
-        lseek(gif->fd, 1, SEEK_CUR);
+        gd_seek(gif, 1, SEEK_CUR);
     } else if (gif->application) {
-        off_t sub_block = lseek(gif->fd, 0, SEEK_CUR);
+        off_t sub_block = gd_seek(gif, 0, SEEK_CUR);
         gif->application(gif, app_id, app_auth_code);
-        lseek(gif->fd, sub_block, SEEK_SET);
+        gd_seek(gif, sub_block, SEEK_SET);
         discard_sub_blocks(gif);
     } else {
         discard_sub_blocks(gif);
@@ -213,7 +359,7 @@ read_ext(gd_GIF *gif)
 {
     uint8_t label;
 
-    read(gif->fd, &label, 1);
+    gd_read(gif, &label, 1);
     switch (label) {
     case 0x01:
         read_plain_text_ext(gif);
@@ -233,11 +379,18 @@ read_ext(gd_GIF *gif)
 }
 
 static Table *
-new_table(int key_size)
+new_table(gd_GIF *gif, int key_size)
 {
     int key;
     int init_bulk = MAX(1 << (key_size + 1), 0x100);
-    Table *table = malloc(sizeof(*table) + sizeof(Entry) * init_bulk);
+    Table *table;
+    if (gif->arena) {
+        /* The arena's table already holds the most entries possible. */
+        table = gif->arena->table;
+        init_bulk = MAX_ENTRIES;
+    } else {
+        table = malloc(sizeof(*table) + sizeof(Entry) * init_bulk);
+    }
     if (table) {
         table->bulk = init_bulk;
         table->nentries = (1 << key_size) + 2;
@@ -278,14 +431,18 @@ get_key(gd_GIF *gif, int key_size, uint8_t *sub_len, uint8_t *shift, uint8_t *by
     int frag_size;
     uint16_t key;
 
+    STAT(gif->stats.codes++);
+    STAT(gif->stats.widths[key_size]++);
     key = 0;
     for (bits_read = 0; bits_read < key_size; bits_read += frag_size) {
         rpad = (*shift + bits_read) % 8;
         if (rpad == 0) {
             /* Update byte. */
-            if (*sub_len == 0)
-                read(gif->fd, sub_len, 1); /* Must be nonzero! */
-            read(gif->fd, byte, 1);
+            if (*sub_len == 0) {
+                gd_read(gif, sub_len, 1); /* Must be nonzero! */
+                STAT(gif->stats.blocks++);
+            }
+            gd_read(gif, byte, 1);
             (*sub_len)--;
         }
         frag_size = MIN(key_size - bits_read, 8 - rpad);
@@ -320,7 +477,8 @@ interlaced_line_index(int h, int y)
 }
 
 /* Decompress image pixels.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table). */
+ * Return 0 on success or -1 on an unsupported LZW minimum code size or
+ * out-of-memory (w.r.t. LZW code table). */
 static int
 read_image_data(gd_GIF *gif, int interlace)
 {
@@ -333,15 +491,19 @@ read_image_data(gd_GIF *gif, int interlace)
     Entry entry;
     off_t start, end;
 
-    read(gif->fd, &byte, 1);
+    /* LZW Minimum Code Size, which must fit the table of MAX_ENTRIES. */
+    if (gd_read(gif, &byte, 1) != 1 || byte < 2 || byte > 8)
+        return -1;
     key_size = (int) byte;
-    start = lseek(gif->fd, 0, SEEK_CUR);
+    start = gd_seek(gif, 0, SEEK_CUR);
     discard_sub_blocks(gif);
-    end = lseek(gif->fd, 0, SEEK_CUR);
-    lseek(gif->fd, start, SEEK_SET);
+    end = gd_seek(gif, 0, SEEK_CUR);
+    gd_seek(gif, start, SEEK_SET);
     clear = 1 << key_size;
     stop = clear + 1;
-    table = new_table(key_size);
+    table = new_table(gif, key_size);
+    if (!table)
+        return -1;
     key_size++;
     init_key_size = key_size;
     sub_len = shift = 0;
@@ -356,7 +518,8 @@ read_image_data(gd_GIF *gif, int interlace)
         } else if (!table_is_full) {
             ret = add_entry(&table, str_len + 1, key, entry.suffix);
             if (ret == -1) {
-                free(table);
+                if (!gif->arena)
+                    free(table);
                 return -1;
             }
             if (table->nentries == 0x1000) {
@@ -365,11 +528,17 @@ read_image_data(gd_GIF *gif, int interlace)
             }
         }
         key = get_key(gif, key_size, &sub_len, &shift, &byte);
-        if (key == clear) continue;
+        if (key == clear) {
+            STAT(gif->stats.resets++);
+            STAT(gif->stats.fill += table->nentries);
+            continue;
+        }
         if (key == stop) break;
         if (ret == 1) key_size++;
         entry = table->entries[key];
         str_len = entry.length;
+        STAT(gif->stats.strings++);
+        STAT(gif->stats.pixels += str_len);
         while (1) {
             p = frm_off + entry.length - 1;
             x = p % gif->fw;
@@ -386,38 +555,47 @@ read_image_data(gd_GIF *gif, int interlace)
         if (key < table->nentries - 1 && !table_is_full)
             table->entries[table->nentries - 1].suffix = entry.suffix;
     }
-    free(table);
-    read(gif->fd, &sub_len, 1); /* Must be zero! */
-    lseek(gif->fd, end, SEEK_SET);
+    if (!gif->arena)
+        free(table);
+    gd_read(gif, &sub_len, 1); /* Must be zero! */
+    gd_seek(gif, end, SEEK_SET);
     return 0;
 }
 
-/* Read image.
- * Return 0 on success or -1 on out-of-memory (w.r.t. LZW code table). */
+/* Read image descriptor and local color table.
+ * Return 0 on success or -1 if the GIF ends first. */
 static int
-read_image(gd_GIF *gif)
+read_image_descriptor(gd_GIF *gif)
 {
     uint8_t fisrz;
-    int interlace;
-
-    /* Image Descriptor. */
-    gif->fx = read_num(gif->fd);
-    gif->fy = read_num(gif->fd);
-    gif->fw = read_num(gif->fd);
-    gif->fh = read_num(gif->fd);
-    read(gif->fd, &fisrz, 1);
-    interlace = fisrz & 0x40;
+
+    if (read_num(gif, &gif->fx) == -1 || read_num(gif, &gif->fy) == -1 ||
+        read_num(gif, &gif->fw) == -1 || read_num(gif, &gif->fh) == -1 ||
+        gd_read(gif, &fisrz, 1) != 1)
+        return -1;
+    gif->interlace = fisrz & 0x40;
     /* Ignore Sort Flag. */
     /* Local Color Table? */
     if (fisrz & 0x80) {
         /* Read LCT */
         gif->lct.size = 1 << ((fisrz & 0x07) + 1);
-        read(gif->fd, gif->lct.colors, 3 * gif->lct.size);
+        gd_read(gif, gif->lct.colors, 3 * gif->lct.size);
         gif->palette = &gif->lct;
     } else
         gif->palette = &gif->gct;
+    return 0;
+}
+
+/* Read image.
+ * Return 0 on success or -1 on a truncated descriptor or out-of-memory
+ * (w.r.t. LZW code table). */
+static int
+read_image(gd_GIF *gif)
+{
+    if (read_image_descriptor(gif) == -1)
+        return -1;
     /* Image Data. */
-    return read_image_data(gif, interlace);
+    return read_image_data(gif, gif->interlace);
 }
 
 static void
@@ -442,6 +620,8 @@ dispose(gd_GIF *gif)
 {
     int i, j, k;
     uint8_t *bgcolor;
+    if (!gif->canvas)
+        return;
     switch (gif->gce.disposal) {
     case 2: /* Restore to background color. */
         bgcolor = &gif->palette->colors[gif->bgindex*3];
@@ -460,27 +640,61 @@ dispose(gd_GIF *gif)
     }
 }
 
-/* Return 1 if got a frame; 0 if got GIF trailer; -1 if error. */
-int
-gd_get_frame(gd_GIF *gif)
+/* Read up to the next image descriptor.
+ * Return 1 if got one; 0 if got GIF trailer; -1 if error. */
+static int
+next_image(gd_GIF *gif)
 {
     char sep;
 
-    dispose(gif);
-    read(gif->fd, &sep, 1);
+    if (gd_read(gif, &sep, 1) != 1)
+        return -1;
     while (sep != ',') {
         if (sep == ';')
             return 0;
         if (sep == '!')
             read_ext(gif);
         else return -1;
-        read(gif->fd, &sep, 1);
+        if (gd_read(gif, &sep, 1) != 1)
+            return -1;
     }
+    return 1;
+}
+
+/* Return 1 if got a frame; 0 if got GIF trailer; -1 if error. */
+int
+gd_get_frame(gd_GIF *gif)
+{
+    int ret;
+
+    dispose(gif);
+    ret = next_image(gif);
+    if (ret != 1)
+        return ret;
     if (read_image(gif) == -1)
         return -1;
     return 1;
 }
 
+/* Return 1 if skipped a frame; 0 if got GIF trailer; -1 if error. */
+int
+gd_skip_frame(gd_GIF *gif)
+{
+    uint8_t key_size;
+    int ret;
+
+    ret = next_image(gif);
+    if (ret != 1)
+        return ret;
+    if (read_image_descriptor(gif) == -1)
+        return -1;
+    /* LZW Minimum Code Size, then Image Data sub-blocks. */
+    if (gd_read(gif, &key_size, 1) != 1)
+        return -1;
+    discard_sub_blocks(gif);
+    return 1;
+}
+
 void
 gd_render_frame(gd_GIF *gif, uint8_t *buffer)
 {
@@ -497,12 +711,14 @@ gd_is_bgcolor(gd_GIF *gif, uint8_t color[3])
 void
 gd_rewind(gd_GIF *gif)
 {
-    lseek(gif->fd, gif->anim_start, SEEK_SET);
+    gd_seek(gif, gif->anim_start, SEEK_SET);
 }
 
 void
 gd_close_gif(gd_GIF *gif)
 {
-    close(gif->fd);
-    free(gif);
+    if (gif->fd != -1)
+        close(gif->fd);
+    if (!gif->arena)
+        free(gif);
 }
@@ -4,6 +4,21 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+/* gd_open_gif_flags() flags */
+#define GD_NO_CANVAS 1 /* don't allocate the RGB canvas; gd_render_frame() is unavailable */
+#define GD_NO_FRAME  2 /* don't allocate the index frame either; only gd_skip_frame() is available */
+
+/* LZW counters, compiled in only when LZW_STATS is defined */
+typedef struct gd_Stats {
+    uint64_t codes;      /* codes, including clear and stop codes */
+    uint64_t widths[13]; /* codes of each bit width */
+    uint64_t resets;     /* clear codes after the first */
+    uint64_t fill;       /* sum of dictionary sizes at each reset */
+    uint64_t strings;    /* pixel strings, i.e. codes other than clear and stop */
+    uint64_t pixels;     /* pixels, so pixels / strings is average string length */
+    uint64_t blocks;     /* data sub-blocks */
+} gd_Stats;
+
 typedef struct gd_Palette {
     int size;
     uint8_t colors[0x100 * 3];
@@ -17,8 +32,15 @@ typedef struct gd_GCE {
     int transparency;
 } gd_GCE;
 
+/* LZW table and GIF storage reused by each GIF decoded on the arena in
+ * turn, so decoding allocates nothing once the arena is warm. */
+typedef struct gd_Arena gd_Arena;
+
 typedef struct gd_GIF {
-    int fd;
+    int fd; /* -1 when decoding from memory */
+    const uint8_t *data;
+    size_t size;
+    off_t pos;
     off_t anim_start;
     uint16_t width, height;
     uint16_t depth;
@@ -34,15 +56,34 @@ typedef struct gd_GIF {
     void (*comment)(struct gd_GIF *gif);
     void (*application)(struct gd_GIF *gif, char id[8], char auth[3]);
     uint16_t fx, fy, fw, fh;
+    int interlace;
     uint8_t bgindex;
     uint8_t *canvas, *frame;
+    gd_Arena *arena;
+#ifdef LZW_STATS
+    gd_Stats stats;
+#endif
 } gd_GIF;
 
 gd_GIF *gd_open_gif(const char *fname);
+gd_GIF *gd_open_gif_flags(const char *fname, int flags);
+/* Decode from the current position of fd, which is closed with the GIF. */
+gd_GIF *gd_open_gif_fd(int fd, int flags);
+/* Decode from memory, which must outlive the GIF. */
+gd_GIF *gd_open_gif_mem(const uint8_t *data, size_t size, int flags);
+/* Like gd_open_gif_flags() and gd_open_gif_mem(), but keep the GIF in the
+ * arena, which holds one GIF at a time. */
+gd_GIF *gd_open_gif_arena(const char *fname, int flags, gd_Arena *arena);
+gd_GIF *gd_open_gif_mem_arena(const uint8_t *data, size_t size, int flags, gd_Arena *arena);
 int gd_get_frame(gd_GIF *gif);
+/* Like gd_get_frame(), but only read the image descriptor and skip the image
+ * data by sub-block lengths, leaving frame and canvas untouched. */
+int gd_skip_frame(gd_GIF *gif);
 void gd_render_frame(gd_GIF *gif, uint8_t *buffer);
 int gd_is_bgcolor(gd_GIF *gif, uint8_t color[3]);
 void gd_rewind(gd_GIF *gif);
 void gd_close_gif(gd_GIF *gif);
+gd_Arena *gd_new_arena(void);
+void gd_del_arena(gd_Arena *arena);
 
 #endif /* GIFDEC_H */
@@ -12,8 +12,23 @@
 #include <unistd.h>
 #endif
 
+/* count allocations of each conversion only if asked to */
+#ifdef ALLOC_STATS
+#include "alloc.h"
+#endif
+
+/* count LZW internals only if asked to */
+#ifdef LZW_STATS
+#define STAT(x) (x)
+#else
+#define STAT(x) ((void) 0)
+#endif
+
+/* most trie nodes alive at once: the root plus one per key below 0x1000 */
+#define MAX_NODES 0x1000
+
 /* helper to write a little-endian 16-bit number portably */
-#define write_num(fd, n) write((fd), (uint8_t []) {(n) & 0xFF, (n) >> 8}, 2)
+#define write_num(gif, n) put_bytes((gif), (uint8_t []) {(n) & 0xFF, (n) >> 8}, 2)
 
 static uint8_t vga[0x30] = {
     0x00, 0x00, 0x00,
@@ -40,77 +55,301 @@ struct Node {
 };
 typedef struct Node Node;
 
+/* Nodes of the strings p, pp, ppp, ... of one pixel value p, shortest
+ * first.  Lets runs of p jump straight to the longest matching string. */
+typedef struct Run {
+    Node **nodes;
+    int len, cap;
+} Run;
+
+/* Trie nodes are carved from one pool, so a new trie just rewinds it
+ * instead of freeing every node of the old one. */
+struct ge_Arena {
+    ge_GIF gif;
+    uint8_t *pool;
+    size_t pool_size, node_size;
+    int nnodes;
+    Run runs[0x100];
+    uint8_t *data;
+    size_t capacity;
+    uint8_t *frames; /* frame buffers and colour tables of a buffered GIF */
+    size_t frames_size;
+};
+
 static Node *
-new_node(uint16_t key, int degree)
+new_node(ge_Arena *arena, uint16_t key)
 {
-    Node *node = calloc(1, sizeof(*node) + degree * sizeof(Node *));
-    if (node)
-        node->key = key;
+    Node *node = (Node *) &arena->pool[arena->nnodes++ * arena->node_size];
+    memset(node, 0, arena->node_size);
+    node->key = key;
     return node;
 }
 
 static Node *
-new_trie(int degree, int *nkeys)
+new_trie(ge_Arena *arena, int degree, int *nkeys)
 {
-    Node *root = new_node(0, degree);
+    Node *root;
+
+    arena->nnodes = 0;
+    root = new_node(arena, 0);
     /* Create nodes for single pixels. */
     for (*nkeys = 0; *nkeys < degree; (*nkeys)++)
-        root->children[*nkeys] = new_node(*nkeys, degree);
+        root->children[*nkeys] = new_node(arena, *nkeys);
     *nkeys += 2; /* skip clear code and stop code */
     return root;
 }
 
+/* Size the pool for a full trie of the given degree. */
+static int
+reserve_nodes(ge_Arena *arena, int degree)
+{
+    size_t node_size = sizeof(Node) + degree * sizeof(Node *);
+
+    if (node_size * MAX_NODES > arena->pool_size) {
+        free(arena->pool);
+        arena->pool = malloc(node_size * MAX_NODES);
+        arena->pool_size = arena->pool ? node_size * MAX_NODES : 0;
+        if (!arena->pool)
+            return 0;
+    }
+    arena->node_size = node_size;
+    return 1;
+}
+
+/* Point every run back at the single-pixel strings of a new trie.
+ * Return 0 and set the error flag if a run can't be allocated. */
+static int
+reset_runs(ge_GIF *gif, Node *root, int degree)
+{
+    Run *runs = gif->runs;
+    int i;
+
+    for (i = 0; i < degree; i++) {
+        if (!runs[i].cap) {
+            runs[i].nodes = malloc(16 * sizeof(Node *));
+            if (!runs[i].nodes) {
+                gif->error = 1;
+                return 0;
+            }
+            runs[i].cap = 16;
+        }
+        runs[i].nodes[0] = root->children[i];
+        runs[i].len = 1;
+    }
+    return 1;
+}
+
+/* Record a new node if it extends the run of its pixel value.  If the run
+ * can't grow, set the error flag and leave the run as it was. */
 static void
-del_trie(Node *root, int degree)
+grow_run(ge_GIF *gif, Run *run, Node *parent, Node *child)
 {
-    if (!root)
+    Node **nodes;
+
+    if (run->nodes[run->len - 1] != parent)
         return;
-    for (int i = 0; i < degree; i++)
-        del_trie(root->children[i], degree);
-    free(root);
+    if (run->len == run->cap) {
+        nodes = realloc(run->nodes, 2 * run->cap * sizeof(Node *));
+        if (!nodes) {
+            gif->error = 1;
+            return;
+        }
+        run->nodes = nodes;
+        run->cap *= 2;
+    }
+    run->nodes[run->len++] = child;
+}
+
+/* Count leading pixels equal to value, a word at a time. */
+static int
+run_length(const uint8_t *pixels, int n, uint8_t value)
+{
+    uint64_t word, pattern = 0x0101010101010101ULL * value;
+    int i = 0;
+
+    while (i + 8 <= n) {
+        memcpy(&word, &pixels[i], 8);
+        if (word != pattern)
+            break;
+        i += 8;
+    }
+    while (i < n && pixels[i] == value)
+        i++;
+    return i;
+}
+
+/* Write bytes to the output file, or append them to the memory buffer
+ * if the GIF has no file.  Set the error flag if they can't be stored. */
+static void
+put_bytes(ge_GIF *gif, const void *bytes, size_t size)
+{
+    uint8_t *data;
+    size_t capacity;
+
+    if (gif->fd != -1) {
+        if (write(gif->fd, bytes, size) != (ssize_t) size)
+            gif->error = 1;
+        return;
+    }
+    if (gif->size + size > gif->capacity) {
+        capacity = gif->capacity ? gif->capacity : 0x1000;
+        while (capacity < gif->size + size)
+            capacity *= 2;
+        data = realloc(gif->data, capacity);
+        if (!data) {
+            gif->error = 1;
+            return;
+        }
+        gif->data = data;
+        gif->capacity = capacity;
+    }
+    memcpy(&gif->data[gif->size], bytes, size);
+    gif->size += size;
 }
 
 static void put_loop(ge_GIF *gif, uint16_t loop);
+static ge_GIF *new_gif(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, int buffered, ge_Arena *arena
+);
 
 ge_GIF *
 ge_new_gif(
     const char *fname, uint16_t width, uint16_t height,
     uint8_t *palette, int depth, int loop
 )
+{
+    return new_gif(fname, width, height, palette, depth, loop, 1, NULL);
+}
+
+ge_GIF *
+ge_new_gif_stream(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop
+)
+{
+    return new_gif(fname, width, height, palette, depth, loop, 0, NULL);
+}
+
+ge_GIF *
+ge_new_gif_stream_arena(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, ge_Arena *arena
+)
+{
+    return new_gif(fname, width, height, palette, depth, loop, 0, arena);
+}
+
+ge_GIF *
+ge_new_gif_arena(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, ge_Arena *arena
+)
+{
+    return new_gif(fname, width, height, palette, depth, loop, 1, arena);
+}
+
+ge_Arena *
+ge_new_arena(void)
+{
+    return calloc(1, sizeof(ge_Arena));
+}
+
+void
+ge_del_arena(ge_Arena *arena)
+{
+    int i;
+
+    if (!arena)
+        return;
+    for (i = 0; i < 0x100; i++)
+        free(arena->runs[i].nodes);
+    free(arena->pool);
+    free(arena->data);
+    free(arena->frames);
+    free(arena);
+}
+
+static ge_GIF *
+new_gif(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, int buffered, ge_Arena *arena
+)
 {
     int i, r, g, b, v;
-    ge_GIF *gif = calloc(1, sizeof(*gif) + 2*width*height);
-    if (!gif)
-        goto no_gif;
+    size_t frames_sz = buffered ? 2*width*height + 2*0x300 : 0;
+    uint8_t *frames;
+    ge_GIF *gif;
+    if (arena) {
+        /* Grow the arena's frame buffers only for a larger GIF than before. */
+        if (frames_sz > arena->frames_size) {
+            frames = realloc(arena->frames, frames_sz);
+            if (!frames)
+                goto no_gif;
+            arena->frames = frames;
+            arena->frames_size = frames_sz;
+        }
+        /* Reuse the arena's GIF, keeping its memory output buffer. */
+        gif = &arena->gif;
+        memset(gif, 0, sizeof(*gif));
+        gif->arena = arena;
+        gif->data = arena->data;
+        gif->capacity = arena->capacity;
+        frames = arena->frames;
+        if (buffered)
+            memset(frames, 0, frames_sz);
+    } else {
+        gif = calloc(1, sizeof(*gif) + frames_sz);
+        if (!gif)
+            goto no_gif;
+        gif->arena = ge_new_arena();
+        gif->own_arena = 1;
+        if (!gif->arena)
+            goto no_fd;
+        frames = (uint8_t *) &gif[1];
+    }
     gif->w = width; gif->h = height;
     gif->depth = depth > 1 ? depth : 2;
-    gif->frame = (uint8_t *) &gif[1];
-    gif->back = &gif->frame[width*height];
+    if (buffered) {
+        gif->frame = frames;
+        gif->back = &gif->frame[width*height];
+        gif->gct = &gif->back[width*height];
+        gif->lct = &gif->gct[0x300];
+    }
+    if (fname) {
 #ifdef _WIN32
-    gif->fd = creat(fname, S_IWRITE);
+        gif->fd = creat(fname, S_IWRITE);
 #else
-    gif->fd = creat(fname, 0666);
+        gif->fd = creat(fname, 0666);
 #endif
-    if (gif->fd == -1)
-        goto no_fd;
+        if (gif->fd == -1)
+            goto no_fd;
 #ifdef _WIN32
-    setmode(gif->fd, O_BINARY);
+        setmode(gif->fd, O_BINARY);
 #endif
-    write(gif->fd, "GIF89a", 6);
-    write_num(gif->fd, width);
-    write_num(gif->fd, height);
-    write(gif->fd, (uint8_t []) {0xF0 | (depth-1), 0x00, 0x00}, 3);
+    } else {
+        /* Encode into memory. */
+        gif->fd = -1;
+    }
+    put_bytes(gif, "GIF89a", 6);
+    write_num(gif, width);
+    write_num(gif, height);
+    put_bytes(gif, (uint8_t []) {0xF0 | (depth-1), 0x00, 0x00}, 3);
     if (palette) {
-        write(gif->fd, palette, 3 << depth);
+        put_bytes(gif, palette, 3 << depth);
+        if (buffered) {
+            memcpy(gif->gct, palette, 3 << depth);
+            gif->has_gct = 1;
+        }
     } else if (depth <= 4) {
-        write(gif->fd, vga, 3 << depth);
+        put_bytes(gif, vga, 3 << depth);
     } else {
-        write(gif->fd, vga, sizeof(vga));
+        put_bytes(gif, vga, sizeof(vga));
         i = 0x10;
         for (r = 0; r < 6; r++) {
             for (g = 0; g < 6; g++) {
                 for (b = 0; b < 6; b++) {
-                    write(gif->fd, (uint8_t []) {r*51, g*51, b*51}, 3);
+                    put_bytes(gif, (uint8_t []) {r*51, g*51, b*51}, 3);
                     if (++i == 1 << depth)
                         goto done_gct;
                 }
@@ -118,7 +357,7 @@ ge_new_gif(
         }
         for (i = 1; i <= 24; i++) {
             v = i * 0xFF / 25;
-            write(gif->fd, (uint8_t []) {v, v, v}, 3);
+            put_bytes(gif, (uint8_t []) {v, v, v}, 3);
         }
     }
 done_gct:
@@ -126,7 +365,10 @@ done_gct:
         put_loop(gif, (uint16_t) loop);
     return gif;
 no_fd:
-    free(gif);
+    if (gif->own_arena) {
+        ge_del_arena(gif->arena);
+        free(gif);
+    }
 no_gif:
     return NULL;
 }
@@ -134,111 +376,296 @@ no_gif:
 static void
 put_loop(ge_GIF *gif, uint16_t loop)
 {
-    write(gif->fd, (uint8_t []) {'!', 0xFF, 0x0B}, 3);
-    write(gif->fd, "NETSCAPE2.0", 11);
-    write(gif->fd, (uint8_t []) {0x03, 0x01}, 2);
-    write_num(gif->fd, loop);
-    write(gif->fd, "\0", 1);
+    put_bytes(gif, (uint8_t []) {'!', 0xFF, 0x0B}, 3);
+    put_bytes(gif, "NETSCAPE2.0", 11);
+    put_bytes(gif, (uint8_t []) {0x03, 0x01}, 2);
+    write_num(gif, loop);
+    put_bytes(gif, "\0", 1);
 }
 
-/* Add packed key to buffer, updating offset and partial.
- *   gif->offset holds position to put next *bit*
- *   gif->partial holds bits to include in next byte */
+/* Write the first nblocks 255-byte sub-blocks of the code buffer with their
+ * length prefixes in one call, then move any remaining bytes to the front. */
 static void
-put_key(ge_GIF *gif, uint16_t key, int key_size)
+put_blocks(ge_GIF *gif, int nblocks)
 {
-    int byte_offset, bit_offset, bits_to_write;
-    byte_offset = gif->offset / 8;
-    bit_offset = gif->offset % 8;
-    gif->partial |= ((uint32_t) key) << bit_offset;
-    bits_to_write = bit_offset + key_size;
-    while (bits_to_write >= 8) {
-        gif->buffer[byte_offset++] = gif->partial & 0xFF;
-        if (byte_offset == 0xFF) {
-            write(gif->fd, "\xFF", 1);
-            write(gif->fd, gif->buffer, 0xFF);
-            byte_offset = 0;
-        }
-        gif->partial >>= 8;
-        bits_to_write -= 8;
+    uint8_t out[GE_CODE_BLOCKS * 0x100];
+    int i, n;
+
+    n = 0;
+    for (i = 0; i < nblocks; i++) {
+        out[n++] = 0xFF;
+        memcpy(&out[n], &gif->codes[i * 0xFF], 0xFF);
+        n += 0xFF;
     }
-    gif->offset = (gif->offset + key_size) % (0xFF * 8);
+    put_bytes(gif, out, n);
+    STAT(gif->stats.blocks += nblocks);
+    gif->ncodes -= nblocks * 0xFF;
+    memmove(gif->codes, &gif->codes[nblocks * 0xFF], gif->ncodes);
+}
+
+/* Add packed key to the 64-bit accumulator, flushing 32 bits at a time.
+ *   gif->bits holds pending bits, lowest first
+ *   gif->nbits counts them, and is always below 32 between keys */
+static void
+put_key(ge_GIF *gif, uint16_t key, int key_size)
+{
+    uint8_t *codes;
+
+    STAT(gif->stats.codes++);
+    STAT(gif->stats.widths[key_size]++);
+    gif->bits |= ((uint64_t) key) << gif->nbits;
+    gif->nbits += key_size;
+    if (gif->nbits < 32)
+        return;
+    codes = &gif->codes[gif->ncodes];
+    codes[0] = gif->bits;
+    codes[1] = gif->bits >> 8;
+    codes[2] = gif->bits >> 16;
+    codes[3] = gif->bits >> 24;
+    gif->ncodes += 4;
+    gif->bits >>= 32;
+    gif->nbits -= 32;
+    if (gif->ncodes >= GE_CODE_BLOCKS * 0xFF)
+        put_blocks(gif, GE_CODE_BLOCKS);
 }
 
 static void
 end_key(ge_GIF *gif)
 {
-    int byte_offset;
-    byte_offset = gif->offset / 8;
-    if (gif->offset % 8)
-        gif->buffer[byte_offset++] = gif->partial & 0xFF;
-    write(gif->fd, (uint8_t []) {byte_offset}, 1);
-    write(gif->fd, gif->buffer, byte_offset);
-    write(gif->fd, "\0", 1);
-    gif->offset = gif->partial = 0;
+    int nblocks;
+
+    /* Flush whole bytes, then every full sub-block. */
+    while (gif->nbits >= 8) {
+        gif->codes[gif->ncodes++] = gif->bits & 0xFF;
+        gif->bits >>= 8;
+        gif->nbits -= 8;
+    }
+    nblocks = gif->ncodes / 0xFF;
+    put_blocks(gif, nblocks);
+    /* Last sub-block holds the rest, including any partial byte. */
+    if (gif->nbits)
+        gif->codes[gif->ncodes++] = gif->bits & 0xFF;
+    STAT(gif->stats.blocks += gif->ncodes > 0);
+    put_bytes(gif, (uint8_t []) {gif->ncodes}, 1);
+    put_bytes(gif, gif->codes, gif->ncodes);
+    put_bytes(gif, "\0", 1);
+    gif->bits = 0;
+    gif->nbits = 0;
+    gif->ncodes = 0;
 }
 
+/* Start LZW-compressed image data for a w x h rectangle at (x, y),
+ * shown in the local colour table lct, or the global one if NULL. */
 static void
-put_image(ge_GIF *gif, uint16_t w, uint16_t h, uint16_t x, uint16_t y)
+begin_image(ge_GIF *gif, uint16_t w, uint16_t h, uint16_t x, uint16_t y, const uint8_t *lct)
+{
+    int degree = 1 << gif->depth;
+
+    put_bytes(gif, ",", 1);
+    write_num(gif, x);
+    write_num(gif, y);
+    write_num(gif, w);
+    write_num(gif, h);
+    if (lct) {
+        put_bytes(gif, (uint8_t []) {0x80 | (gif->depth-1)}, 1);
+        put_bytes(gif, lct, 3 << gif->depth);
+    } else {
+        put_bytes(gif, (uint8_t []) {0x00}, 1);
+    }
+    put_bytes(gif, (uint8_t []) {gif->depth}, 1);
+    if (!reserve_nodes(gif->arena, degree)) {
+        gif->error = 1;
+        gif->root = gif->node = NULL;
+        return;
+    }
+    gif->root = gif->node = new_trie(gif->arena, degree, &gif->nkeys);
+    gif->runs = gif->arena->runs;
+    reset_runs(gif, gif->root, degree);
+    gif->key_size = gif->depth + 1;
+    put_key(gif, degree, gif->key_size); /* clear code */
+}
+
+/* Compress a run of n pixels of one value, starting from the string of a
+ * single such pixel.  Emits exactly the keys the pixel-by-pixel loop would,
+ * but jumps along the run's strings instead of walking the trie.  Returns
+ * the node matched once the run ends. */
+static Node *
+put_run(ge_GIF *gif, Node **rootp, int *nkeysp, int *key_sizep, int pixel, int n)
 {
-    int nkeys, key_size, i, j;
+    Run *run = &gif->runs[pixel];
+    Node *node;
+    int len = 1;
+    int degree = 1 << gif->depth;
+
+    while (n > 0) {
+        if (len + n <= run->len)
+            return run->nodes[len + n - 1];
+        /* Match the longest string of the run, which has no child yet. */
+        n -= run->len - len;
+        node = run->nodes[run->len - 1];
+        put_key(gif, node->key, *key_sizep);
+        STAT(gif->stats.strings++);
+        if (*nkeysp < 0x1000) {
+            if (*nkeysp == (1 << *key_sizep))
+                (*key_sizep)++;
+            node->children[pixel] = new_node(gif->arena, (*nkeysp)++);
+            grow_run(gif, run, node, node->children[pixel]);
+        } else {
+            put_key(gif, degree, *key_sizep); /* clear code */
+            STAT(gif->stats.resets++);
+            STAT(gif->stats.fill += *nkeysp);
+            *rootp = new_trie(gif->arena, degree, nkeysp);
+            if (!reset_runs(gif, *rootp, degree))
+                return (*rootp)->children[pixel];
+            *key_sizep = gif->depth + 1;
+        }
+        /* The pixel that didn't fit starts the next string. */
+        len = 1;
+        n--;
+    }
+    return run->nodes[len - 1];
+}
+
+/* Compress the next n pixels of the image. */
+static void
+put_pixels(ge_GIF *gif, const uint8_t *pixels, int n)
+{
+    int nkeys, key_size, i, len;
     Node *node, *child, *root;
     int degree = 1 << gif->depth;
 
-    write(gif->fd, ",", 1);
-    write_num(gif->fd, x);
-    write_num(gif->fd, y);
-    write_num(gif->fd, w);
-    write_num(gif->fd, h);
-    write(gif->fd, (uint8_t []) {0x00, gif->depth}, 2);
-    root = node = new_trie(degree, &nkeys);
-    key_size = gif->depth + 1;
-    put_key(gif, degree, key_size); /* clear code */
-    for (i = y; i < y+h; i++) {
-        for (j = x; j < x+w; j++) {
-            uint8_t pixel = gif->frame[i*gif->w+j] & (degree - 1);
-            child = node->children[pixel];
-            if (child) {
-                node = child;
+    if (gif->error)
+        return;
+    root = gif->root;
+    node = gif->node;
+    nkeys = gif->nkeys;
+    key_size = gif->key_size;
+    STAT(gif->stats.pixels += n);
+    for (i = 0; i < n; i++) {
+        uint8_t pixel = pixels[i] & (degree - 1);
+        child = node->children[pixel];
+        if (child) {
+            node = child;
+        } else {
+            put_key(gif, node->key, key_size);
+            STAT(gif->stats.strings++);
+            if (nkeys < 0x1000) {
+                if (nkeys == (1 << key_size))
+                    key_size++;
+                node->children[pixel] = new_node(gif->arena, nkeys++);
+                grow_run(gif, &gif->runs[pixel], node, node->children[pixel]);
             } else {
-                put_key(gif, node->key, key_size);
-                if (nkeys < 0x1000) {
-                    if (nkeys == (1 << key_size))
-                        key_size++;
-                    node->children[pixel] = new_node(nkeys++, degree);
-                } else {
-                    put_key(gif, degree, key_size); /* clear code */
-                    del_trie(root, degree);
-                    root = node = new_trie(degree, &nkeys);
-                    key_size = gif->depth + 1;
-                }
-                node = root->children[pixel];
+                put_key(gif, degree, key_size); /* clear code */
+                STAT(gif->stats.resets++);
+                STAT(gif->stats.fill += nkeys);
+                root = node = new_trie(gif->arena, degree, &nkeys);
+                reset_runs(gif, root, degree);
+                key_size = gif->depth + 1;
+            }
+            node = root->children[pixel];
+            /* Runs can't be followed once one couldn't be allocated. */
+            if (gif->error)
+                break;
+            /* Take the fast path through runs of the same pixel. */
+            if (i + 1 < n && pixels[i + 1] == pixels[i]) {
+                len = run_length(&pixels[i + 1], n - i - 1, pixels[i]);
+                node = put_run(gif, &root, &nkeys, &key_size, pixel, len);
+                i += len;
             }
         }
     }
-    put_key(gif, node->key, key_size);
-    put_key(gif, degree + 1, key_size); /* stop code */
+    gif->root = root;
+    gif->node = node;
+    gif->nkeys = nkeys;
+    gif->key_size = key_size;
+}
+
+/* Finish image data started with begin_image(). */
+static void
+end_image(ge_GIF *gif)
+{
+    int degree = 1 << gif->depth;
+
+    if (gif->node) {
+        put_key(gif, gif->node->key, gif->key_size);
+        STAT(gif->stats.strings++);
+    }
+    put_key(gif, degree + 1, gif->key_size); /* stop code */
     end_key(gif);
-    del_trie(root, degree);
+    gif->root = gif->node = NULL;
+    gif->runs = NULL;
+}
+
+static void
+put_image(ge_GIF *gif, uint16_t w, uint16_t h, uint16_t x, uint16_t y, const uint8_t *lct)
+{
+    int i;
+
+    begin_image(gif, w, h, x, y, lct);
+    for (i = y; i < y+h; i++)
+        put_pixels(gif, &gif->frame[i*gif->w+x], w);
+    end_image(gif);
+}
+
+/* Return index of first differing byte in [from, to), or to if none.
+ * Bytes are compared a word at a time. */
+static int
+first_diff(const uint8_t *a, const uint8_t *b, int from, int to)
+{
+    uint64_t wa, wb;
+
+    while (from + 8 <= to) {
+        memcpy(&wa, &a[from], 8);
+        memcpy(&wb, &b[from], 8);
+        if (wa != wb)
+            break;
+        from += 8;
+    }
+    while (from < to && a[from] == b[from])
+        from++;
+    return from;
+}
+
+/* Return index of last differing byte in [from, to), or from - 1 if none.
+ * Bytes are compared a word at a time. */
+static int
+last_diff(const uint8_t *a, const uint8_t *b, int from, int to)
+{
+    uint64_t wa, wb;
+
+    while (to - 8 >= from) {
+        memcpy(&wa, &a[to - 8], 8);
+        memcpy(&wb, &b[to - 8], 8);
+        if (wa != wb)
+            break;
+        to -= 8;
+    }
+    while (to > from && a[to - 1] == b[to - 1])
+        to--;
+    return to - 1;
 }
 
 static int
 get_bbox(ge_GIF *gif, uint16_t *w, uint16_t *h, uint16_t *x, uint16_t *y)
 {
-    int i, j, k;
+    int i, j;
     int left, right, top, bottom;
-    left = gif->w; right = 0;
-    top = gif->h; bottom = 0;
-    k = 0;
+    uint8_t *frame, *back;
+    left = gif->w; right = -1;
+    top = gif->h; bottom = -1;
     for (i = 0; i < gif->h; i++) {
-        for (j = 0; j < gif->w; j++, k++) {
-            if (gif->frame[k] != gif->back[k]) {
-                if (j < left)   left    = j;
-                if (j > right)  right   = j;
-                if (i < top)    top     = i;
-                if (i > bottom) bottom  = i;
-            }
-        }
+        frame = &gif->frame[i*gif->w];
+        back = &gif->back[i*gif->w];
+        /* Skip unchanged rows with a single comparison. */
+        if (!memcmp(frame, back, gif->w))
+            continue;
+        if (top == gif->h)  top = i;
+        bottom = i;
+        /* Only columns outside the box so far can widen it. */
+        j = first_diff(frame, back, 0, left);
+        if (j < left)       left    = j;
+        j = last_diff(frame, back, right + 1, gif->w);
+        if (j > right)      right   = j;
     }
     if (left != gif->w && top != gif->h) {
         *x = left; *y = top;
@@ -253,20 +680,35 @@ get_bbox(ge_GIF *gif, uint16_t *w, uint16_t *h, uint16_t *x, uint16_t *y)
 static void
 set_delay(ge_GIF *gif, uint16_t d)
 {
-    write(gif->fd, (uint8_t []) {'!', 0xF9, 0x04, 0x04}, 4);
-    write_num(gif->fd, d);
-    write(gif->fd, "\0\0", 2);
+    put_bytes(gif, (uint8_t []) {'!', 0xF9, 0x04, 0x04}, 4);
+    write_num(gif, d);
+    put_bytes(gif, "\0\0", 2);
 }
 
 void
 ge_add_frame(ge_GIF *gif, uint16_t delay)
+{
+    ge_add_frame_palette(gif, delay, NULL);
+}
+
+void
+ge_add_frame_palette(ge_GIF *gif, uint16_t delay, const uint8_t *palette)
 {
     uint16_t w, h, x, y;
     uint8_t *tmp;
+    size_t size = 3 << gif->depth;
+    int local, changed;
+
+    /* Unchanged indices only keep their colours if the table is the same. */
+    local = palette && !(gif->has_gct && !memcmp(palette, gif->gct, size));
+    changed = local != gif->local || (local && memcmp(palette, gif->lct, size));
+    if (local)
+        memcpy(gif->lct, palette, size);
+    gif->local = local;
 
     if (delay)
         set_delay(gif, delay);
-    if (gif->nframes == 0) {
+    if (gif->nframes == 0 || changed) {
         w = gif->w;
         h = gif->h;
         x = y = 0;
@@ -275,17 +717,71 @@ ge_add_frame(ge_GIF *gif, uint16_t delay)
         w = h = 1;
         x = y = 0;
     }
-    put_image(gif, w, h, x, y);
+    put_image(gif, w, h, x, y, local ? gif->lct : NULL);
     gif->nframes++;
     tmp = gif->back;
     gif->back = gif->frame;
     gif->frame = tmp;
 }
 
+void
+ge_begin_frame(ge_GIF *gif, uint16_t delay)
+{
+    if (delay)
+        set_delay(gif, delay);
+    begin_image(gif, gif->w, gif->h, 0, 0, NULL);
+    gif->rows = 0;
+}
+
+void
+ge_put_rows(ge_GIF *gif, const uint8_t *rows, int nrows)
+{
+    if (nrows > gif->h - gif->rows)
+        nrows = gif->h - gif->rows;
+    put_pixels(gif, rows, nrows * gif->w);
+    gif->rows += nrows;
+}
+
+void
+ge_end_frame(ge_GIF *gif)
+{
+    end_image(gif);
+    gif->nframes++;
+}
+
 void
 ge_close_gif(ge_GIF* gif)
 {
-    write(gif->fd, ";", 1);
-    close(gif->fd);
-    free(gif);
+    put_bytes(gif, ";", 1);
+    if (gif->fd != -1)
+        close(gif->fd);
+    if (gif->own_arena) {
+        free(gif->data);
+        ge_del_arena(gif->arena);
+        free(gif);
+    } else {
+        /* Keep the memory output buffer for the arena's next GIF. */
+        gif->arena->data = gif->data;
+        gif->arena->capacity = gif->capacity;
+    }
+}
+
+uint8_t *
+ge_close_gif_mem(ge_GIF *gif, size_t *size)
+{
+    uint8_t *data;
+
+    put_bytes(gif, ";", 1);
+    data = gif->error ? NULL : gif->data;
+    *size = gif->error ? 0 : gif->size;
+    if (gif->own_arena) {
+        if (gif->error)
+            free(gif->data);
+        ge_del_arena(gif->arena);
+        free(gif);
+    } else {
+        gif->arena->data = gif->data;
+        gif->arena->capacity = gif->capacity;
+    }
+    return data;
 }
@@ -2,23 +2,92 @@
 #define GIFENC_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+/* Number of 255-byte sub-blocks of codes buffered between writes */
+#define GE_CODE_BLOCKS 16
+
+/* LZW counters, compiled in only when LZW_STATS is defined */
+typedef struct ge_Stats {
+    uint64_t codes;      /* codes, including clear and stop codes */
+    uint64_t widths[13]; /* codes of each bit width */
+    uint64_t resets;     /* clear codes after the first */
+    uint64_t fill;       /* sum of dictionary sizes at each reset */
+    uint64_t strings;    /* pixel strings, i.e. codes other than clear and stop */
+    uint64_t pixels;     /* pixels, so pixels / strings is average string length */
+    uint64_t blocks;     /* data sub-blocks */
+} ge_Stats;
+
+struct Node;
+struct Run;
+
+/* Trie nodes, runs and memory output reused by each GIF encoded on the
+ * arena in turn, so encoding allocates nothing once the arena is warm. */
+typedef struct ge_Arena ge_Arena;
 
 typedef struct ge_GIF {
     uint16_t w, h;
     int depth;
     int fd;
-    int offset;
     int nframes;
     uint8_t *frame, *back;
-    uint32_t partial;
-    uint8_t buffer[0xFF];
+    uint8_t *gct, *lct; /* global table and last local table of buffered GIFs */
+    int has_gct, local;
+    uint64_t bits;
+    int nbits;
+    int ncodes;
+    uint8_t codes[GE_CODE_BLOCKS * 0xFF + 4];
+    uint8_t *data;
+    size_t size, capacity;
+    int error; /* set when output couldn't be stored or the encoder's tables couldn't grow */
+    struct Node *root, *node;
+    struct Run *runs;
+    ge_Arena *arena;
+    int own_arena;
+    int nkeys, key_size;
+    int rows;
+#ifdef LZW_STATS
+    ge_Stats stats;
+#endif
 } ge_GIF;
 
 ge_GIF *ge_new_gif(
     const char *fname, uint16_t width, uint16_t height,
     uint8_t *palette, int depth, int loop
 );
+/* Like ge_new_gif(), but keep the GIF, its frame buffers and tables in the
+ * arena, which holds one GIF at a time. */
+ge_GIF *ge_new_gif_arena(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, ge_Arena *arena
+);
 void ge_add_frame(ge_GIF *gif, uint16_t delay);
+/* Like ge_add_frame(), but show the frame in the given colours, 3 << depth
+ * bytes written as a local colour table unless they match the global one.
+ * A frame whose colours differ from the previous frame's is written whole. */
+void ge_add_frame_palette(ge_GIF *gif, uint16_t delay, const uint8_t *palette);
+
+/* Streaming API: no frame buffers are kept, so ge_add_frame() can't be
+ * used. Each frame is written whole, row by row, between ge_begin_frame()
+ * and ge_end_frame(). */
+ge_GIF *ge_new_gif_stream(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop
+);
+/* Like ge_new_gif_stream(), but keep the GIF and its tables in the arena,
+ * which holds one GIF at a time.  Memory returned by ge_close_gif_mem()
+ * then belongs to the arena and is reused by its next GIF. */
+ge_GIF *ge_new_gif_stream_arena(
+    const char *fname, uint16_t width, uint16_t height,
+    uint8_t *palette, int depth, int loop, ge_Arena *arena
+);
+void ge_begin_frame(ge_GIF *gif, uint16_t delay);
+void ge_put_rows(ge_GIF *gif, const uint8_t *rows, int nrows);
+void ge_end_frame(ge_GIF *gif);
 void ge_close_gif(ge_GIF* gif);
+/* Return the GIF encoded in memory, or NULL if it couldn't all be stored. */
+uint8_t *ge_close_gif_mem(ge_GIF *gif, size_t *size);
+ge_Arena *ge_new_arena(void);
+void ge_del_arena(ge_Arena *arena);
 
 #endif /* GIFENC_H */
@@ -0,0 +1,52 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_ALLOC_H
+#define REDIMAGE_ALLOC_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+// Heap use of one conversion, counted only when ALLOC_STATS is defined
+typedef struct alloc_stats {
+    uint64_t allocations; // Calls to malloc, calloc and realloc
+    uint64_t bytes;       // Bytes requested, counting the whole new size of a realloc
+    uint64_t peak;        // Most live heap bytes above those held when the conversion began
+} alloc_stats;
+
+// Heap use of every conversion recorded so far, on any thread
+typedef struct alloc_totals {
+    uint64_t conversions;
+    uint64_t allocations;
+    uint64_t bytes;
+    uint64_t peak;     // Highest peak of any conversion
+    uint64_t peak_sum; // Sum of peaks, for the mean
+} alloc_totals;
+
+#ifdef ALLOC_STATS
+void alloc_begin(void);
+void alloc_end(alloc_stats *stats);
+void alloc_get_totals(alloc_totals *totals);
+void alloc_reset_totals(void);
+
+void *alloc_malloc(size_t size);
+void *alloc_calloc(size_t count, size_t size);
+void *alloc_realloc(void *pointer, size_t size);
+void alloc_free(void *pointer);
+
+// Count allocations of every file including this header
+#ifndef REDIMAGE_ALLOC_C
+#define malloc(size) alloc_malloc(size)
+#define calloc(count, size) alloc_calloc(count, size)
+#define realloc(pointer, size) alloc_realloc(pointer, size)
+#define free(pointer) alloc_free(pointer)
+#endif
+#else
+#define alloc_begin() ((void) 0)
+#define alloc_end(stats) ((void) 0)
+#endif
+
+#endif
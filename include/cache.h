@@ -0,0 +1,25 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_CACHE_H
+#define REDIMAGE_CACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "output.h"
+
+uint64_t cache_hash(uint64_t hash, const uint8_t *data, size_t size);
+int cache_hash_file(uint64_t *hash, const char *path);
+
+int cache_link(const char *source_path, const char *destination_path);
+
+int cache_key(uint64_t *key, char mode, const char *options, const char *input_path, const char *palette_path);
+int cache_fetch(const char *cache_dir, uint64_t key, const char *output_path);
+int cache_store(const char *cache_dir, uint64_t key, const char *output_path);
+
+#endif
@@ -10,8 +10,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "version.h"
 #include "image.h"
+#include "cache.h"
+#include "compare.h"
+#include "manifest.h"
+#include "pack.h"
+#include "palette.h"
+#include "output.h"
+#include "trace.h"
+#include "watch.h"
+#include "pipeline.h"
 
 int main(int argc, char *argv[]);
 
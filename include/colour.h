@@ -0,0 +1,47 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_COLOUR_H
+#define REDIMAGE_COLOUR_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "alloc.h"
+#include "kernels.h"
+
+// Set compile-time constants
+#define COLOUR_MAX_WIDTH 320
+
+typedef enum dither_mode {
+    DITHER_NONE,
+    DITHER_FLOYD_STEINBERG,
+    DITHER_ORDERED
+} dither_mode;
+
+typedef struct colour_map {
+    // Target palette with 6-bit colour values
+    uint8_t palette[768];
+
+    // Nearest palette index plus one for every 6-bit colour, or zero if not yet searched
+    uint16_t cube[64 * 64 * 64];
+
+    // Floyd-Steinberg error rows, wide enough for the widest game image
+    int errors[2 * (COLOUR_MAX_WIDTH + 2) * 3];
+} colour_map;
+
+colour_map *colour_map_new(const uint8_t *palette);
+void colour_map_set_palette(colour_map *map, const uint8_t *palette);
+uint8_t colour_map_nearest(colour_map *map, uint8_t red, uint8_t green, uint8_t blue);
+int colour_map_remap_table(colour_map *map, uint8_t *table, const uint8_t *source_palette, int source_size);
+void colour_map_free(colour_map *map);
+
+int quantise_rgb(colour_map *map, uint8_t *destination, const uint8_t *rgb, int width, int height, dither_mode dither);
+
+void remap_indices(uint8_t *destination, const uint8_t *source, size_t size, const uint8_t *table);
+void expand_palette(uint8_t *destination, const uint8_t *source, size_t size, const uint8_t *palette, int channels);
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_COMPARE_H
+#define REDIMAGE_COMPARE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct compare_result {
+    uint16_t width;
+    uint16_t height;
+    uint32_t changed;        // Pixels whose index or colour differs
+    uint32_t index_changes;  // Pixels whose palette index differs
+    uint32_t colour_changes; // Pixels whose colour differs
+    uint16_t left, top, right, bottom; // Bounding box of changed pixels, if any
+    uint8_t max_delta;       // Largest difference of any colour channel
+} compare_result;
+
+int compare_images(const char *first_path, const char *second_path, const char *palette_path, const char *diff_path, compare_result *result);
+
+#endif
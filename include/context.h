@@ -0,0 +1,39 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_CONTEXT_H
+#define REDIMAGE_CONTEXT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "gifenc.h"
+#include "gifdec.h"
+#include "colour.h"
+#include "alloc.h"
+
+// Buffers and codec arenas reused by each conversion given the context, which runs one conversion at a time
+typedef struct convert_context {
+    ge_Arena *encoder;
+    gd_Arena *decoder;
+
+    // Colour map of the last target palette, or NULL until one is needed
+    colour_map *map;
+
+    // Scratch colour palettes and image data, sized for the largest format
+    uint8_t palette[768];
+    uint8_t frame_palette[768];
+    uint8_t image_data[65536];
+
+    // True-colour pixels, sized for the largest format with an alpha channel
+    uint8_t rgb[65536 * 4];
+} convert_context;
+
+convert_context *context_new(void);
+colour_map *context_colour_map(convert_context *context, const uint8_t *palette);
+void context_free(convert_context *context);
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_DEDUP_H
+#define REDIMAGE_DEDUP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "manifest.h"
+
+int *dedup_manifest(const manifest *list);
+int dedup_report(const char *report_path, const manifest *list, const int *canonical);
+
+#endif
@@ -13,24 +13,89 @@
 #include <string.h>
 #include "gifenc.h"
 #include "gifdec.h"
+#include "colour.h"
+#include "context.h"
+#include "output.h"
+#include "transform.h"
+#include "alloc.h"
 
-int col_to_gif(FILE *file_pointer, const char *gif_path);
-int mph_to_gif(FILE *file_pointer, const char *gif_path);
-int raw_to_gif(FILE *file_pointer, const char *gif_path);
-int tm_to_gif(FILE *file_pointer, const char *palette_path, const char *gif_path);
+// Set file sizes of each image type
+#define COL_SIZE 768
+#define TM_SIZE 49152
+#define RAW_SIZE 64768
+#define MPH_SIZE 65536
 
-int image_to_gif(const char *image_path, const char *palette_path, const char *gif_path);
-int embedded_image_to_gif(const char *image_path, const char *gif_path);
+// True-colour output formats
+typedef enum rgb_format {
+    RGB_NONE,
+    RGB_PPM,
+    RGB_BMP,
+    RGB_RGBA
+} rgb_format;
 
-int gif_to_col(gd_GIF *gif, const char *image_path);
-int gif_to_mph(gd_GIF *gif, const char *image_path);
-int gif_to_raw(gd_GIF *gif, const char *image_path);
-int gif_to_tm(gd_GIF *gif, const char *palette_path, const char *image_path);
+// Image metadata read from headers alone
+typedef struct image_info {
+    const char *type;    // GIF, PPM, COL, TM, RAW or MPH
+    uint16_t width;
+    uint16_t height;
+    const char *palette; // Source of the colours
+    int frames;
+    int interlaced;      // Whether any gif frame is interlaced
+    int colours;         // Global colour table size, or 0 for true-colour
+} image_info;
 
-int gif_to_image(const char *gif_path, const char *palette_path, const char *image_path);
-int gif_to_embedded_image(const char *gif_path, const char *image_path);
+int col_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path);
+int mph_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path);
+int raw_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path);
+int tm_to_gif(convert_context *context, FILE *file_pointer, const char *palette_path, const char *gif_path);
+
+int tm_to_gifs(convert_context *context, FILE *file_pointer, const char **palette_paths, const char **gif_paths, int count);
+
+int image_to_gif(convert_context *context, const char *image_path, const char *palette_path, const char *gif_path);
+int image_to_gifs(convert_context *context, const char *image_path, const char **palette_paths, const char **gif_paths, int count);
+int embedded_image_to_gif(convert_context *context, const char *image_path, const char *gif_path);
+
+int load_image(const char *image_path, const char *palette_path, uint8_t *palette, uint8_t *image_data, uint16_t *width, uint16_t *height);
+int images_to_gif(convert_context *context, const char **image_paths, int count, const char *palette_path, uint16_t delay, const char *gif_path);
+
+int gif_to_col(convert_context *context, gd_GIF *gif, const char *image_path);
+int gif_to_mph(convert_context *context, gd_GIF *gif, const char *image_path);
+int gif_to_raw(convert_context *context, gd_GIF *gif, const char *image_path);
+int gif_to_tm(convert_context *context, gd_GIF *gif, const char *palette_path, const char *image_path);
+
+int gif_frame_to_image(convert_context *context, gd_GIF *gif, const char *palette_path, const char *image_path);
+int gif_to_image(convert_context *context, const char *gif_path, const char *palette_path, const char *image_path);
+int gif_to_embedded_image(convert_context *context, const char *gif_path, const char *image_path);
+
+rgb_format get_rgb_format(const char *path);
+int image_to_rgb(convert_context *context, const char *image_path, const char *palette_path, const char *output_path, rgb_format format);
+
+int split_raw(const char *raw_path, const char *palette_path, const char *pixels_path);
+int merge_palette(const char *pixels_path, const char *palette_path, const char *image_path);
+int transform_image(const char *image_path, const transform *t, const char *output_path);
+
+int probe_image(const char *path, image_info *info);
+
+int is_ppm(const char *path);
+int is_gif(const char *path);
+int ppm_to_image(convert_context *context, const char *ppm_path, const char *palette_path, const char *image_path, dither_mode dither);
+
+uint8_t *load_rgb(const char *image_path, int *width, int *height);
+int rgb_to_image(colour_map *map, const uint8_t *rgb, int width, int height, uint8_t *image_data, const char *image_path, dither_mode dither);
+
+int image_data_to_gif(convert_context *context, const uint8_t *image_data, size_t image_size, const char *palette_path, const char *gif_path);
+// Convert in memory into the caller's buffer, grown along with its capacity only when too small
+int image_data_to_gif_data(convert_context *context, const uint8_t *image_data, size_t image_size, const uint8_t *palette_data, size_t palette_size, uint8_t **gif_data, size_t *gif_capacity, size_t *gif_size);
+int gif_data_to_image_data(convert_context *context, const uint8_t *gif_data, size_t gif_size, const uint8_t *palette_data, size_t palette_size, uint8_t **image_data, size_t *image_capacity, size_t *image_size);
+int ppm_to_image_data(convert_context *context, const char *ppm_path, const char *palette_path, dither_mode dither, uint8_t **image_data, size_t *image_capacity, size_t *image_size);
+
+#ifdef LZW_STATS
+void image_lzw_stats(ge_Stats *encoder, gd_Stats *decoder);
+void image_reset_lzw_stats(void);
+#endif
 
 int read_palette(uint8_t *palette, FILE *palette_pointer);
 int read_palette_from_file(uint8_t *palette, const char *palette_path);
+int write_palette_to_file(const char *palette_path, const uint8_t *palette);
 
 #endif
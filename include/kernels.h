@@ -0,0 +1,29 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_KERNELS_H
+#define REDIMAGE_KERNELS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Instruction sets of the kernel variants, chosen for the processor on first use
+typedef enum kernel_level {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2
+} kernel_level;
+
+kernel_level kernels_level(void);
+int kernels_set_level(kernel_level level);
+const char *kernels_name(kernel_level level);
+
+int kernel_scale_up(uint8_t *data, size_t size);
+void kernel_scale_down(uint8_t *destination, const uint8_t *source, size_t size);
+void kernel_expand(uint8_t *destination, const uint8_t *source, size_t size, const uint32_t *colours, int channels);
+
+#endif
@@ -0,0 +1,28 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_MANIFEST_H
+#define REDIMAGE_MANIFEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct manifest_entry {
+    char *source;
+    char *palette; // NULL for images with an embedded palette
+    char *destination;
+} manifest_entry;
+
+typedef struct manifest {
+    int count;
+    manifest_entry *entries;
+} manifest;
+
+manifest *manifest_read(const char *manifest_path);
+void manifest_free(manifest *list);
+
+#endif
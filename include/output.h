@@ -0,0 +1,28 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_OUTPUT_H
+#define REDIMAGE_OUTPUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Outputs renamed into place between folder syncs
+#define OUTPUT_GROUP_SIZE 256
+
+void output_temp_path(char *temp_path, size_t temp_size, const char *path);
+int output_commit(const char *temp_path, const char *path);
+int output_commit_group(char *const *temp_paths, const char *const *paths, int count, int *results);
+void output_abort(const char *temp_path);
+void output_staged_path(char *current_path, size_t current_size, const char *path);
+
+// Between these, outputs are synced and renamed into place together when the group fills or ends
+void output_begin_group(void);
+int output_end_group(void);
+int output_sync(void);
+
+#endif
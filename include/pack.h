@@ -0,0 +1,72 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_PACK_H
+#define REDIMAGE_PACK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "gifdec.h"
+#include "output.h"
+
+// Longest entry name, excluding the terminator
+#define PACK_NAME_SIZE 47
+
+typedef enum pack_type {
+    PACK_OTHER,
+    PACK_GIF,
+    PACK_COL,
+    PACK_TM,
+    PACK_RAW,
+    PACK_MPH
+} pack_type;
+
+typedef struct pack_entry {
+    char name[PACK_NAME_SIZE + 1];
+    pack_type type;
+    uint64_t offset;
+    uint64_t length;
+} pack_entry;
+
+// Zero-copy view of an entry in a mapped pack, which image_data_to_gif and gd_open_gif_mem read in place
+typedef struct pack_view {
+    const uint8_t *data;
+    size_t size;
+    pack_type type;
+} pack_view;
+
+typedef struct pack_writer {
+    char *path;
+    char *temp_path;
+    FILE *file_pointer;
+    uint64_t offset;
+    int count;
+    int capacity;
+    pack_entry *entries;
+} pack_writer;
+
+typedef struct pack_reader {
+    const uint8_t *data;
+    size_t size;
+    uint32_t count;
+    const uint8_t *index;
+} pack_reader;
+
+pack_writer *pack_create(const char *pack_path);
+int pack_add_data(pack_writer *writer, const char *name, const uint8_t *data, size_t size);
+int pack_close(pack_writer *writer);
+
+pack_reader *pack_open(const char *pack_path);
+int pack_get(const pack_reader *reader, uint32_t i, pack_entry *entry);
+int pack_find(const pack_reader *reader, const char *name, pack_view *view);
+gd_GIF *pack_open_gif(const pack_reader *reader, const char *name, int flags);
+void pack_close_reader(pack_reader *reader);
+
+const char *pack_type_name(pack_type type);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_PALETTE_H
+#define REDIMAGE_PALETTE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "colour.h"
+
+int check_remap_images(const char **image_paths, int count, const char *output_dir);
+int generate_palette(const char **image_paths, int count, int workers, uint8_t *palette);
+int remap_images(const char **image_paths, int count, int workers, const char *palette_path, const char *output_dir, dither_mode dither);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_PIPELINE_H
+#define REDIMAGE_PIPELINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "manifest.h"
+
+int convert_manifest(const char *manifest_path, int workers, const char *report_path);
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_TRACE_H
+#define REDIMAGE_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+void trace_start(const char *trace_path);
+void trace_name_thread(const char *name);
+uint64_t trace_begin(void);
+void trace_end(const char *name, const char *detail, uint64_t start);
+int trace_finish(void);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_TRANSFORM_H
+#define REDIMAGE_TRANSFORM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum transform_type {
+    TRANSFORM_FLIP_HORIZONTAL,
+    TRANSFORM_FLIP_VERTICAL,
+    TRANSFORM_ROTATE_90,
+    TRANSFORM_ROTATE_180,
+    TRANSFORM_ROTATE_270,
+    TRANSFORM_CROP
+} transform_type;
+
+typedef struct transform {
+    transform_type type;
+
+    // Region kept by a crop, which is tiled to fill the image again
+    int x;
+    int y;
+    int width;
+    int height;
+} transform;
+
+int parse_transform(const char *text, transform *t);
+int transform_pixels(uint8_t *destination, const uint8_t *source, int width, int height, const transform *t);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_URING_H
+#define REDIMAGE_URING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Largest number of reads and writes in flight at once
+#define URING_ENTRIES 64
+
+typedef struct uring_completion {
+    uint64_t user_data;
+    int result;
+} uring_completion;
+
+// Batches reads and writes through io_uring, or runs them synchronously where io_uring is unavailable
+typedef struct uring {
+    int fd;
+    unsigned queued;
+    unsigned in_flight;
+
+    // Submission ring
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    void *sqes;
+
+    // Completion ring
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void *cqes;
+
+    // Ring mappings
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    // Completions of synchronous fallback operations
+    unsigned completed;
+    uring_completion completions[URING_ENTRIES];
+} uring;
+
+int uring_init(uring *ring);
+int uring_read(uring *ring, int fd, void *buffer, size_t size, uint64_t offset, uint64_t user_data);
+int uring_write(uring *ring, int fd, const void *buffer, size_t size, uint64_t offset, uint64_t user_data);
+int uring_wait(uring *ring, uring_completion *completion);
+int uring_cancel(uring *ring);
+void uring_exit(uring *ring);
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#ifndef REDIMAGE_WATCH_H
+#define REDIMAGE_WATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converts input to output, encoding for mode 'e' and decoding for 'd'
+typedef int (*watch_converter)(char mode, const char *input_path, const char *palette_path, const char *output_path);
+
+int watch_folder(const char *source_dir, const char *output_dir, const char *palette_path, watch_converter convert);
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+// Call the real allocator here
+#define REDIMAGE_ALLOC_C
+
+#include "alloc.h"
+
+#ifdef ALLOC_STATS
+#include <string.h>
+#include <pthread.h>
+#include <malloc.h>
+#ifdef _WIN32
+#define usable_size(pointer) ((pointer) != NULL ? _msize(pointer) : 0)
+#else
+#define usable_size(pointer) malloc_usable_size(pointer)
+#endif
+
+// Sizes come from the allocator rather than a header, so blocks can pass between files that do not count them
+static _Thread_local int64_t live = 0;
+static _Thread_local int64_t start_live = 0;
+static _Thread_local int64_t peak_live = 0;
+static _Thread_local uint64_t allocations = 0;
+static _Thread_local uint64_t bytes = 0;
+
+static pthread_mutex_t totals_mutex = PTHREAD_MUTEX_INITIALIZER;
+static alloc_totals totals;
+
+static void add_live(const int64_t size) {
+    live += size;
+    if (live > peak_live) {
+        peak_live = live;
+    }
+}
+
+void alloc_begin(void) {
+    start_live = peak_live = live;
+    allocations = bytes = 0;
+}
+
+void alloc_end(alloc_stats *stats) {
+    // Live bytes may fall below the start when this thread frees blocks of another
+    const alloc_stats current = {allocations, bytes, peak_live > start_live ? peak_live - start_live : 0};
+    if (stats != NULL) {
+        *stats = current;
+    }
+
+    pthread_mutex_lock(&totals_mutex);
+    totals.conversions++;
+    totals.allocations += current.allocations;
+    totals.bytes += current.bytes;
+    totals.peak_sum += current.peak;
+    if (current.peak > totals.peak) {
+        totals.peak = current.peak;
+    }
+    pthread_mutex_unlock(&totals_mutex);
+}
+
+void alloc_get_totals(alloc_totals *result) {
+    pthread_mutex_lock(&totals_mutex);
+    *result = totals;
+    pthread_mutex_unlock(&totals_mutex);
+}
+
+void alloc_reset_totals(void) {
+    pthread_mutex_lock(&totals_mutex);
+    memset(&totals, 0, sizeof(totals));
+    pthread_mutex_unlock(&totals_mutex);
+}
+
+void *alloc_malloc(const size_t size) {
+    void *pointer = malloc(size);
+    if (pointer != NULL) {
+        allocations++;
+        bytes += size;
+        add_live(usable_size(pointer));
+    }
+    return pointer;
+}
+
+void *alloc_calloc(const size_t count, const size_t size) {
+    void *pointer = calloc(count, size);
+    if (pointer != NULL) {
+        allocations++;
+        bytes += count * size;
+        add_live(usable_size(pointer));
+    }
+    return pointer;
+}
+
+void *alloc_realloc(void *pointer, const size_t size) {
+    // The old block is only released if the new one was allocated, or if no size was asked for
+    const int64_t old_size = usable_size(pointer);
+    void *new_pointer = realloc(pointer, size);
+    if (new_pointer != NULL) {
+        allocations++;
+        bytes += size;
+        add_live((int64_t) usable_size(new_pointer) - old_size);
+    } else if (size == 0) {
+        live -= old_size;
+    }
+    return new_pointer;
+}
+
+void alloc_free(void *pointer) {
+    live -= usable_size(pointer);
+    free(pointer);
+}
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "cache.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+// Set compile-time constants
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+#define CHUNK_SIZE 65536
+
+// Bump whenever a conversion would write different output for the same input and options
+#define CACHE_FORMAT_VERSION 1
+
+uint64_t cache_hash(uint64_t hash, const uint8_t *data, size_t size) {
+    // 64-bit FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+int cache_hash_file(uint64_t *hash, const char *path) {
+    // Open file
+    FILE *file_pointer = fopen(path, "rb");
+    if (file_pointer == NULL) {
+        return 0;
+    }
+
+    // Hash file contents in chunks
+    uint8_t *chunk = malloc(CHUNK_SIZE);
+    size_t read_size;
+    while ((read_size = fread(chunk, 1, CHUNK_SIZE, file_pointer)) > 0) {
+        *hash = cache_hash(*hash, chunk, read_size);
+    }
+    const int read_status = ferror(file_pointer) == 0;
+    fclose(file_pointer);
+    free(chunk);
+
+    return read_status;
+}
+
+int cache_key(uint64_t *key, char mode, const char *options, const char *input_path, const char *palette_path) {
+    // Hash cache format version and mode, so output changes invalidate old results
+    const uint8_t header[2] = {CACHE_FORMAT_VERSION, (uint8_t) mode};
+    *key = cache_hash(FNV_OFFSET, header, sizeof(header));
+
+    // Hash options that change the output, including the terminator
+    *key = cache_hash(*key, (const uint8_t *) options, strlen(options) + 1);
+
+    // Hash input contents
+    if (cache_hash_file(key, input_path) != 1) {
+        return 0;
+    }
+
+    // Hash palette contents, marking whether one was given
+    const uint8_t has_palette = palette_path != NULL;
+    *key = cache_hash(*key, &has_palette, 1);
+    if (palette_path != NULL && cache_hash_file(key, palette_path) != 1) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static void get_entry_path(char *entry_path, size_t entry_size, const char *cache_dir, uint64_t key, const char *suffix) {
+    snprintf(entry_path, entry_size, "%s/%016llx%s", cache_dir, (unsigned long long) key, suffix);
+}
+
+static int copy_file(const char *source_path, const char *destination_path) {
+    // Open source file
+    FILE *source_pointer = fopen(source_path, "rb");
+    if (source_pointer == NULL) {
+        return 0;
+    }
+
+    // Open destination file
+    FILE *destination_pointer = fopen(destination_path, "wb");
+    if (destination_pointer == NULL) {
+        fclose(source_pointer);
+        return 0;
+    }
+
+    // Copy file contents in chunks
+    uint8_t *chunk = malloc(CHUNK_SIZE);
+    size_t read_size;
+    int copy_status = 1;
+    while ((read_size = fread(chunk, 1, CHUNK_SIZE, source_pointer)) > 0) {
+        if (fwrite(chunk, read_size, 1, destination_pointer) != 1) {
+            copy_status = 0;
+            break;
+        }
+    }
+    if (ferror(source_pointer)) {
+        copy_status = 0;
+    }
+    fclose(source_pointer);
+    if (fclose(destination_pointer) != 0) {
+        copy_status = 0;
+    }
+    free(chunk);
+
+    return copy_status;
+}
+
+static int reflink_file(const char *source_path, const char *destination_path) {
+#ifdef FICLONE
+    // Share the source's blocks copy-on-write, on file systems that support it
+    const int source_fd = open(source_path, O_RDONLY);
+    if (source_fd == -1) {
+        return 0;
+    }
+    const int destination_fd = open(destination_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (destination_fd == -1) {
+        close(source_fd);
+        return 0;
+    }
+    int clone_status = ioctl(destination_fd, FICLONE, source_fd) == 0;
+    close(source_fd);
+    if (close(destination_fd) != 0) {
+        clone_status = 0;
+    }
+    if (clone_status != 1) {
+        remove(destination_path);
+    }
+    return clone_status;
+#else
+    return 0;
+#endif
+}
+
+int cache_link(const char *source_path, const char *destination_path) {
+    // Link or copy to a temporary file, then rename it over the destination
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), destination_path);
+    remove(temp_path);
+
+    // Prefer a reflink, whose copies stay independent, then a hard link, then a plain copy
+    int link_status = reflink_file(source_path, temp_path);
+#ifndef _WIN32
+    if (link_status != 1) {
+        link_status = link(source_path, temp_path) == 0;
+    }
+#endif
+    if (link_status != 1) {
+        link_status = copy_file(source_path, temp_path);
+    }
+    if (link_status != 1) {
+        output_abort(temp_path);
+        return 0;
+    }
+
+    return output_commit(temp_path, destination_path);
+}
+
+int cache_fetch(const char *cache_dir, uint64_t key, const char *output_path) {
+    char entry_path[FILENAME_MAX];
+    get_entry_path(entry_path, sizeof(entry_path), cache_dir, key, "");
+
+    // Check for a cached result
+    FILE *entry_pointer = fopen(entry_path, "rb");
+    if (entry_pointer == NULL) {
+        return 0;
+    }
+    fclose(entry_pointer);
+
+    return cache_link(entry_path, output_path);
+}
+
+int cache_store(const char *cache_dir, uint64_t key, const char *output_path) {
+    char entry_path[FILENAME_MAX];
+    char temp_path[FILENAME_MAX];
+    get_entry_path(entry_path, sizeof(entry_path), cache_dir, key, "");
+    output_temp_path(temp_path, sizeof(temp_path), entry_path);
+
+    // Copy output to a temporary entry, then rename so readers never see a partial entry
+    if (copy_file(output_path, temp_path) != 1) {
+        remove(temp_path);
+        fprintf(stderr, "Could not write to cache\n");
+        return 0;
+    }
+#ifdef _WIN32
+    // Windows cannot rename over an existing file
+    remove(entry_path);
+#endif
+    if (rename(temp_path, entry_path) != 0) {
+        remove(temp_path);
+        fprintf(stderr, "Could not write to cache\n");
+        return 0;
+    }
+
+    return 1;
+}
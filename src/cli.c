@@ -6,27 +6,598 @@
 
 #include "cli.h"
 
-int main(const int argc, char *argv[]) {
+// Directory of cached conversion results, or NULL if caching is disabled
+static const char *cache_dir = NULL;
+
+// Colour palette for .TM frames of animations
+static const char *frame_palette_path = NULL;
+
+// Number of conversion threads for manifests, or 0 to use every processor
+static int workers = 0;
+
+// Report of duplicate manifest entries, or NULL to convert every entry
+static const char *dedup_report_path = NULL;
+
+// Dithering used when quantising true-colour images
+static dither_mode dither = DITHER_NONE;
+
+// Whether to report LZW counters and allocations after converting
+static int show_stats = 0;
+
+// Buffers and codec arenas shared by every conversion of this run, or NULL until the first
+static convert_context *context = NULL;
+
+static convert_context *get_context(void) {
+    if (context == NULL) {
+        context = context_new();
+        if (context == NULL) {
+            fprintf(stderr, "Could not create conversion context\n");
+        }
+    }
+    return context;
+}
+
+static int convert(const char mode, const char *input_path, const char *palette_path, const char *output_path) {
+    // Reuse a cached result if the inputs are unchanged
+    uint64_t key = 0;
+    int use_cache = 0;
+    const char *extension = strrchr(output_path, '.');
+    char options[32];
+    snprintf(options, sizeof(options), "dither=%d,%.16s", dither, extension != NULL ? extension : "");
+    if (cache_dir != NULL && cache_key(&key, mode, options, input_path, palette_path) == 1) {
+        if (cache_fetch(cache_dir, key, output_path) == 1) {
+            return 1;
+        }
+        use_cache = 1;
+    }
+
+    // Run conversion
+    if (get_context() == NULL) {
+        return 0;
+    }
+    const uint64_t convert_start = trace_begin();
+    alloc_begin();
+    int status;
+    const rgb_format format = get_rgb_format(output_path);
+    if (mode == 'd' && format != RGB_NONE) {
+        status = image_to_rgb(context, input_path, palette_path, output_path, format);
+    } else if (mode == 'd') {
+        status = palette_path != NULL ? image_to_gif(context, input_path, palette_path, output_path) : embedded_image_to_gif(context, input_path, output_path);
+    } else if (is_ppm(input_path)) {
+        if (palette_path == NULL) {
+            fprintf(stderr, "True-colour images require a colour palette\n");
+            status = 0;
+            goto finish;
+        }
+        status = ppm_to_image(context, input_path, palette_path, output_path, dither);
+    } else {
+        status = palette_path != NULL ? gif_to_image(context, input_path, palette_path, output_path) : gif_to_embedded_image(context, input_path, output_path);
+    }
+
+    // Close the allocation and trace spans on every path out of the conversion
+finish:
+    alloc_end(NULL);
+    trace_end(mode == 'd' ? "decode" : "encode", output_path, convert_start);
+
+    // Store result for later runs
+    if (status == 1 && use_cache) {
+        char current_path[FILENAME_MAX];
+        output_staged_path(current_path, sizeof(current_path), output_path);
+        cache_store(cache_dir, key, current_path);
+    }
+
+    return status;
+}
+
+#if defined(LZW_STATS) || defined(ALLOC_STATS)
+static void print_stats(void) {
+#ifdef LZW_STATS
+    ge_Stats encoder;
+    gd_Stats decoder;
+    image_lzw_stats(&encoder, &decoder);
+
+    // Report each codec that ran
+    const struct {
+        const char *name;
+        uint64_t codes, *widths, resets, fill, strings, pixels, blocks;
+    } codecs[] = {
+        {"Encoder", encoder.codes, encoder.widths, encoder.resets, encoder.fill, encoder.strings, encoder.pixels, encoder.blocks},
+        {"Decoder", decoder.codes, decoder.widths, decoder.resets, decoder.fill, decoder.strings, decoder.pixels, decoder.blocks}
+    };
+    for (int i = 0; i < 2; i++) {
+        if (codecs[i].codes == 0) {
+            continue;
+        }
+        printf("%s\n", codecs[i].name);
+        printf("  codes          %llu\n", (unsigned long long) codecs[i].codes);
+        printf("  resets         %llu\n", (unsigned long long) codecs[i].resets);
+        printf("  sub-blocks     %llu\n", (unsigned long long) codecs[i].blocks);
+        printf("  string length  %.2f\n", codecs[i].strings ? (double) codecs[i].pixels / codecs[i].strings : 0.0);
+        printf("  reset fill     %.1f\n", codecs[i].resets ? (double) codecs[i].fill / codecs[i].resets : 0.0);
+        for (int width = 1; width <= 12; width++) {
+            if (codecs[i].widths[width] != 0) {
+                printf("  %2d-bit codes   %llu\n", width, (unsigned long long) codecs[i].widths[width]);
+            }
+        }
+    }
+#endif
+
+#ifdef ALLOC_STATS
+    // Report heap use per conversion, from which memory per worker can be sized
+    alloc_totals totals;
+    alloc_get_totals(&totals);
+    if (totals.conversions > 0) {
+        printf("Memory\n");
+        printf("  conversions    %llu\n", (unsigned long long) totals.conversions);
+        printf("  allocations    %.1f\n", (double) totals.allocations / totals.conversions);
+        printf("  bytes          %.0f\n", (double) totals.bytes / totals.conversions);
+        printf("  mean peak      %.0f\n", (double) totals.peak_sum / totals.conversions);
+        printf("  max peak       %llu\n", (unsigned long long) totals.peak);
+    }
+#endif
+}
+#endif
+
+static int print_info(const char **paths, const int count) {
+    // Probe every file, even after a failure
+    int status = 1;
+    image_info info;
+    for (int i = 0; i < count; i++) {
+        if (probe_image(paths[i], &info) != 1) {
+            fprintf(stderr, "Could not probe %s\n", paths[i]);
+            status = 0;
+            continue;
+        }
+        printf("%s\t%s\t%ux%u\t%s\t%d\t%s\t%d\n", paths[i], info.type, info.width, info.height, info.palette, info.frames, info.interlaced ? "interlaced" : "progressive", info.colours);
+    }
+    return status;
+}
+
+// Return 1 if images match, 0 if they differ and -1 on error
+static int print_comparison(const char *first_path, const char *second_path, const char *diff_path) {
+    compare_result result;
+    if (compare_images(first_path, second_path, frame_palette_path, diff_path, &result) != 1) {
+        return -1;
+    }
+    printf("changed pixels  %u of %u\n", result.changed, (unsigned) result.width * result.height);
+    printf("index changes   %u\n", result.index_changes);
+    printf("colour changes  %u\n", result.colour_changes);
+    if (result.changed > 0) {
+        printf("bounding box    %u,%u to %u,%u\n", result.left, result.top, result.right, result.bottom);
+    }
+    printf("max delta       %u\n", result.max_delta);
+    return result.changed == 0;
+}
+
+static int generate_shared_palette(const char *palette_path, const char *output_dir, const char **image_paths, const int count) {
+    // Check sizes and output names before reading any pixels
+    if (check_remap_images(image_paths, count, output_dir) != 1) {
+        return 0;
+    }
+
+    uint8_t palette[COL_SIZE];
+    if (generate_palette(image_paths, count, workers, palette) != 1 || write_palette_to_file(palette_path, palette) != 1) {
+        fprintf(stderr, "Could not generate colour palette\n");
+        return 0;
+    }
+
+    // Put the palette in place before it is read back
+    if (output_sync() != 1) {
+        return 0;
+    }
+    return remap_images(image_paths, count, workers, palette_path, output_dir, dither);
+}
+
+static int transform_images(const char *operation, const char **paths, const int count) {
+    transform t;
+    if (parse_transform(operation, &t) != 1) {
+        return 0;
+    }
+
+    // Transform every image and output pair, even after a failure
+    int status = 1;
+    for (int i = 0; i < count; i++) {
+        if (transform_image(paths[i * 2], &t, paths[i * 2 + 1]) != 1) {
+            fprintf(stderr, "Could not transform %s\n", paths[i * 2]);
+            status = 0;
+        }
+    }
+    return status;
+}
+
+// Buffers reused by every image converted in memory, grown only when too small
+typedef struct memory_buffers {
+    uint8_t *input, *palette, *output;
+    size_t input_capacity, palette_capacity, output_capacity;
+    size_t input_size, palette_size, output_size;
+} memory_buffers;
+
+static int read_whole_file(const char *path, uint8_t **data, size_t *capacity, size_t *size) {
+    FILE *file_pointer = fopen(path, "rb");
+    if (file_pointer == NULL) {
+        fprintf(stderr, "Error opening %s\n", path);
+        return 0;
+    }
+    setvbuf(file_pointer, NULL, _IONBF, 0);
+    fseek(file_pointer, 0, SEEK_END);
+    const long file_size = ftell(file_pointer);
+    fseek(file_pointer, 0, SEEK_SET);
+    if (file_size < 0) {
+        fclose(file_pointer);
+        fprintf(stderr, "Error reading %s\n", path);
+        return 0;
+    }
+    if ((size_t) file_size > *capacity) {
+        uint8_t *grown = realloc(*data, file_size);
+        if (grown == NULL) {
+            fclose(file_pointer);
+            fprintf(stderr, "Could not allocate %s\n", path);
+            return 0;
+        }
+        *data = grown;
+        *capacity = file_size;
+    }
+    const int read_status = file_size == 0 || fread(*data, file_size, 1, file_pointer) == 1;
+    fclose(file_pointer);
+    if (read_status != 1) {
+        fprintf(stderr, "Error reading %s\n", path);
+        return 0;
+    }
+    *size = file_size;
+    return 1;
+}
+
+static int convert_in_memory(const char *input_path, const char *palette_path, memory_buffers *buffers) {
+    // True-colour images are quantised to the palette straight from the file
+    if (is_ppm(input_path)) {
+        if (palette_path == NULL) {
+            fprintf(stderr, "True-colour images require a colour palette\n");
+            return 0;
+        }
+        return ppm_to_image_data(context, input_path, palette_path, dither, &buffers->output, &buffers->output_capacity, &buffers->output_size);
+    }
+
+    // Read image and palette, then encode gifs and decode game images with the context's arenas
+    if (read_whole_file(input_path, &buffers->input, &buffers->input_capacity, &buffers->input_size) != 1) {
+        return 0;
+    }
+    if (palette_path != NULL && read_whole_file(palette_path, &buffers->palette, &buffers->palette_capacity, &buffers->palette_size) != 1) {
+        return 0;
+    }
+    const uint8_t *palette = palette_path != NULL ? buffers->palette : NULL;
+    if (buffers->input_size >= 3 && memcmp(buffers->input, "GIF", 3) == 0) {
+        return gif_data_to_image_data(context, buffers->input, buffers->input_size, palette, buffers->palette_size, &buffers->output, &buffers->output_capacity, &buffers->output_size);
+    }
+    return image_data_to_gif_data(context, buffers->input, buffers->input_size, palette, buffers->palette_size, &buffers->output, &buffers->output_capacity, &buffers->output_size);
+}
+
+static int pack_manifest(const char *pack_path, const char *manifest_path) {
+    // Read manifest
+    manifest *list = manifest_read(manifest_path);
+    if (list == NULL) {
+        return 0;
+    }
+    if (get_context() == NULL) {
+        manifest_free(list);
+        return 0;
+    }
+
+    // Create pack
+    pack_writer *writer = pack_create(pack_path);
+    if (writer == NULL) {
+        manifest_free(list);
+        return 0;
+    }
+
+    // Convert each entry in memory, then append it to the pack under its destination name
+    memory_buffers buffers = {0};
+    int status = 1;
+    for (int i = 0; i < list->count && status == 1; i++) {
+        const manifest_entry *entry = &list->entries[i];
+        const uint64_t convert_start = trace_begin();
+        alloc_begin();
+        status = convert_in_memory(entry->source, entry->palette, &buffers);
+        alloc_end(NULL);
+        trace_end(status == 1 && buffers.output_size >= 3 && memcmp(buffers.output, "GIF", 3) == 0 ? "decode" : "encode", entry->destination, convert_start);
+        if (status == 1) {
+            status = pack_add_data(writer, entry->destination, buffers.output, buffers.output_size);
+        }
+        if (status != 1) {
+            fprintf(stderr, "Could not pack %s\n", entry->source);
+        }
+    }
+    free(buffers.input);
+    free(buffers.palette);
+    free(buffers.output);
+    manifest_free(list);
+    if (pack_close(writer) != 1) {
+        status = 0;
+    }
+
+    return status;
+}
+
+static int list_pack(const char *pack_path) {
+    pack_reader *reader = pack_open(pack_path);
+    if (reader == NULL) {
+        return 0;
+    }
+    pack_entry entry;
+    for (uint32_t i = 0; i < reader->count; i++) {
+        if (pack_get(reader, i, &entry) != 1) {
+            pack_close_reader(reader);
+            fprintf(stderr, "Invalid pack entry\n");
+            return 0;
+        }
+        printf("%s\t%s\t%llu\n", entry.name, pack_type_name(entry.type), (unsigned long long) entry.length);
+    }
+    pack_close_reader(reader);
+    return 1;
+}
+
+static int has_gif_extension(const char *path) {
+    const char *extension = strrchr(path, '.');
+    return extension != NULL && (strcmp(extension, ".gif") == 0 || strcmp(extension, ".GIF") == 0);
+}
+
+static int extract_pack(const char *pack_path, const char *name, const char *output_path) {
+    pack_reader *reader = pack_open(pack_path);
+    if (reader == NULL) {
+        return 0;
+    }
+
+    // Find entry
+    pack_view view;
+    if (pack_find(reader, name, &view) != 1) {
+        pack_close_reader(reader);
+        fprintf(stderr, "No pack entry %s\n", name);
+        return 0;
+    }
+
+    // Convert entries between gif and game formats in place, when the output is of the other kind
+    if (view.type != PACK_OTHER && (view.type == PACK_GIF) != has_gif_extension(output_path)) {
+        int status = get_context() != NULL;
+        if (status == 1 && view.type == PACK_GIF) {
+            gd_GIF *gif = pack_open_gif(reader, name, GD_NO_CANVAS);
+            if (gif == NULL) {
+                fprintf(stderr, "Error opening gif\n");
+                status = 0;
+            } else {
+                status = gif_frame_to_image(context, gif, frame_palette_path, output_path);
+            }
+        } else if (status == 1) {
+            status = image_data_to_gif(context, view.data, view.size, frame_palette_path, output_path);
+        }
+        pack_close_reader(reader);
+        return status;
+    }
+
+    // Write entry straight from the mapped pack, then rename it into place
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), output_path);
+    FILE *output_pointer = fopen(temp_path, "wb");
+    if (output_pointer == NULL) {
+        pack_close_reader(reader);
+        fprintf(stderr, "Error creating output file\n");
+        return 0;
+    }
+    int write_status = view.size == 0 || fwrite(view.data, view.size, 1, output_pointer) == 1;
+    if (fclose(output_pointer) != 0) {
+        write_status = 0;
+    }
+    pack_close_reader(reader);
+    if (write_status != 1) {
+        output_abort(temp_path);
+        fprintf(stderr, "Error writing output file\n");
+        return 0;
+    }
+
+    return output_commit(temp_path, output_path);
+}
+
+static int run(int argc, char *argv[]) {
+    const char *program = argv[0];
+
+    // Parse options preceding the mode
+    while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--stats") == 0) {
+#if !defined(LZW_STATS) && !defined(ALLOC_STATS)
+            fprintf(stderr, "Built without LZW_STATS or ALLOC_STATS\n");
+            return EXIT_FAILURE;
+#endif
+            show_stats = 1;
+            argc--;
+            argv++;
+            continue;
+        }
+        if (strcmp(argv[1], "--cache") == 0) {
+            cache_dir = argv[2];
+        } else if (strcmp(argv[1], "--workers") == 0) {
+            workers = atoi(argv[2]);
+        } else if (strcmp(argv[1], "--trace") == 0) {
+            trace_start(argv[2]);
+            trace_name_thread("main");
+        } else if (strcmp(argv[1], "--dedup") == 0) {
+            dedup_report_path = argv[2];
+        } else if (strcmp(argv[1], "--palette") == 0) {
+            frame_palette_path = argv[2];
+        } else if (strcmp(argv[1], "--dither") == 0) {
+            if (strcmp(argv[2], "none") == 0) {
+                dither = DITHER_NONE;
+            } else if (strcmp(argv[2], "fs") == 0) {
+                dither = DITHER_FLOYD_STEINBERG;
+            } else if (strcmp(argv[2], "ordered") == 0) {
+                dither = DITHER_ORDERED;
+            } else {
+                fprintf(stderr, "Unknown dither %s\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[1], "--kernels") == 0) {
+            kernel_level level;
+            if (strcmp(argv[2], "scalar") == 0) {
+                level = KERNEL_SCALAR;
+            } else if (strcmp(argv[2], "sse2") == 0) {
+                level = KERNEL_SSE2;
+            } else if (strcmp(argv[2], "avx2") == 0) {
+                level = KERNEL_AVX2;
+            } else {
+                fprintf(stderr, "Unknown kernels %s\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+            if (kernels_set_level(level) != 1) {
+                fprintf(stderr, "Processor does not support %s kernels\n", kernels_name(level));
+                return EXIT_FAILURE;
+            }
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Use every processor unless told otherwise
+    if (workers <= 0) {
+#ifdef _WIN32
+        workers = 4;
+#else
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+
+    // Convert a manifest in bulk
+    if (argc == 3 && strcmp(argv[1], "--manifest") == 0) {
+        const int status = convert_manifest(argv[2], workers, dedup_report_path);
+#if defined(LZW_STATS) || defined(ALLOC_STATS)
+        if (show_stats) {
+            print_stats();
+        }
+#endif
+        return status == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Build one colour palette shared by many images, then remap them to it
+    if (argc >= 5 && strcmp(argv[1], "--generate") == 0) {
+        return generate_shared_palette(argv[2], argv[3], (const char **) &argv[4], argc - 4) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Pack modes
+    if (argc == 4 && strcmp(argv[1], "--pack") == 0) {
+        return pack_manifest(argv[2], argv[3]) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc == 3 && strcmp(argv[1], "--list") == 0) {
+        return list_pack(argv[2]) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc == 5 && strcmp(argv[1], "--extract") == 0) {
+        return extract_pack(argv[2], argv[3], argv[4]) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Report metadata of any number of files
+    if (argc >= 3 && strcmp(argv[1], "--info") == 0) {
+        return print_info((const char **) &argv[2], argc - 2) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Keep converting changed files until interrupted
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--watch") == 0) {
+        return watch_folder(argv[2], argv[3], argc == 5 ? argv[4] : NULL, convert) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Move bytes between game formats directly, without a gif
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--split") == 0) {
+        return split_raw(argv[2], argv[3], argc == 5 ? argv[4] : NULL) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc == 5 && strcmp(argv[1], "--merge") == 0) {
+        return merge_palette(argv[2], argv[3], argv[4]) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Flip, rotate or crop the pixels of game images in place of a gif round trip
+    if (argc >= 5 && (argc - 3) % 2 == 0 && strcmp(argv[1], "--transform") == 0) {
+        return transform_images(argv[2], (const char **) &argv[3], (argc - 3) / 2) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Compare two images, optionally writing a diff gif
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--compare") == 0) {
+        return print_comparison(argv[2], argv[3], argc == 5 ? argv[4] : NULL) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // Animations take any number of frames
+    if (argc >= 5 && (strcmp(argv[1], "-a") == 0 || strcmp(argv[1], "--animate") == 0)) {
+        const int delay = atoi(argv[2]);
+        if (delay < 0 || delay > 0xFFFF) {
+            fprintf(stderr, "Unsupported frame delay\n");
+            return EXIT_FAILURE;
+        }
+        if (get_context() == NULL) {
+            return EXIT_FAILURE;
+        }
+        alloc_begin();
+        const int animate_status = images_to_gif(context, (const char **) &argv[4], argc - 4, frame_palette_path, delay, argv[3]);
+        alloc_end(NULL);
+        if (animate_status != 1) {
+            return EXIT_FAILURE;
+        }
+#if defined(LZW_STATS) || defined(ALLOC_STATS)
+        if (show_stats) {
+            print_stats();
+        }
+#endif
+        return EXIT_SUCCESS;
+    }
+
     switch (argc) {
         // No arguments provided
         case 1:
-            printf("Red Image %d.%d\n", REDIMAGE_VERSION_MAJOR, REDIMAGE_VERSION_MINOR);
+            printf("Red Image %d.%d (%s kernels)\n", REDIMAGE_VERSION_MAJOR, REDIMAGE_VERSION_MINOR, kernels_name(kernels_level()));
             printf("MIT License\n");
             printf("Copyright (c) 2020 Jacob Gelling\n\n");
-            printf("  To decode a image into a GIF:\n");
-            printf("  %s -d image palette gif\n\n", argv[0]);
+            printf("  To decode a image into a GIF, or a .ppm, .bmp or .rgba true-colour file:\n");
+            printf("  %s -d image palette gif\n\n", program);
+            printf("  To decode a .TM image with several palettes, compressing it once:\n");
+            printf("  %s -d image palette gif [palette gif ...]\n\n", program);
+            printf("  To animate images into a GIF, with a delay in hundredths of a second:\n");
+            printf("  %s -a delay gif image [image ...]\n\n", program);
             printf("  To encode a GIF into a image:\n");
-            printf("  %s -e gif palette image\n", argv[0]);
+            printf("  %s -e gif palette image\n\n", program);
+            printf("  To encode a true-colour PPM into a .TM or .RAW image:\n");
+            printf("  %s -e ppm palette image\n\n", program);
+            printf("  To report type, size, palette, frames and interlacing without decoding:\n");
+            printf("  %s --info file [file ...]\n\n", program);
+            printf("  To split a .RAW image into its palette and optionally its pixels, or merge them:\n");
+            printf("  %s --split image palette [pixels]\n", program);
+            printf("  %s --merge pixels palette image\n\n", program);
+            printf("  To flip-h, flip-v, rotate-90, rotate-180, rotate-270 or crop:x,y,width,height images, tiling crops:\n");
+            printf("  %s --transform operation image output [image output ...]\n\n", program);
+            printf("  To compare the pixels of two images, failing if they differ:\n");
+            printf("  %s --compare image image [diff-gif]\n\n", program);
+            printf("  To generate one palette for many GIF or PPM images, remapping each into a .TM or .RAW image:\n");
+            printf("  %s --generate palette output-folder image [image ...]\n\n", program);
+            printf("  To convert files of a folder whenever they change, until interrupted:\n");
+            printf("  %s --watch folder output-folder [palette]\n\n", program);
+            printf("  To convert each source,palette,destination line of a manifest:\n");
+            printf("  %s --manifest manifest\n\n", program);
+            printf("  To convert each source,palette,destination line of a manifest into one pack:\n");
+            printf("  %s --pack pack manifest\n\n", program);
+            printf("  To list or extract the entries of a pack:\n");
+            printf("  %s --list pack\n", program);
+            printf("  %s --extract pack name file\n\n", program);
+            printf("  Options:\n");
+            printf("  --cache dir    reuse results of unchanged conversions\n");
+            printf("  --palette file colour palette for .TM animation frames, comparisons and extraction\n");
+            printf("  --workers n    conversion threads for --manifest and --generate\n");
+            printf("  --trace file   write a Chrome trace of conversion stages on each thread\n");
+            printf("  --dedup report convert identical --manifest inputs once, linking duplicates\n");
+            printf("  --dither mode  dither true-colour images with none, fs or ordered\n");
+            printf("  --kernels set  force scalar, sse2 or avx2 kernels, such as to compare them\n");
+            printf("  --stats        report LZW counters (LZW_STATS builds) or heap use (ALLOC_STATS builds) of conversions\n");
             break;
 
         // Correct number of arguments provided for external palette
         case 5:
             if (strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--decode") == 0) {
-                if (image_to_gif(argv[2], argv[3], argv[4]) != 1) {
+                if (convert('d', argv[2], argv[3], argv[4]) != 1) {
                     return EXIT_FAILURE;
                 }
             } else if (strcmp(argv[1], "-e") == 0 || strcmp(argv[1], "--encode") == 0) {
-                if (gif_to_image(argv[2], argv[3], argv[4]) != 1) {
+                if (convert('e', argv[2], argv[3], argv[4]) != 1) {
                     return EXIT_FAILURE;
                 }
             } else {
@@ -38,11 +609,11 @@ int main(const int argc, char *argv[]) {
         // Correct number of arguments provided for embedded palette
         case 4:
             if (strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--decode") == 0) {
-                if (embedded_image_to_gif(argv[2], argv[3]) != 1) {
+                if (convert('d', argv[2], NULL, argv[3]) != 1) {
                     return EXIT_FAILURE;
                 }
             } else if (strcmp(argv[1], "-e") == 0 || strcmp(argv[1], "--encode") == 0) {
-                if (gif_to_embedded_image(argv[2], argv[3]) != 1) {
+                if (convert('e', argv[2], NULL, argv[3]) != 1) {
                     return EXIT_FAILURE;
                 }
             } else {
@@ -51,11 +622,48 @@ int main(const int argc, char *argv[]) {
             }
             break;
 
-        // Incorrect number of arguments provided
+        // Several palette and gif pairs provided, or incorrect number of arguments
         default:
+            if (argc > 5 && (argc - 3) % 2 == 0 && (strcmp(argv[1], "-d") == 0 || strcmp(argv[1], "--decode") == 0)) {
+                const int count = (argc - 3) / 2;
+                const char **palette_paths = malloc(count * sizeof(char *));
+                const char **gif_paths = malloc(count * sizeof(char *));
+                for (int i = 0; i < count; i++) {
+                    palette_paths[i] = argv[3 + i * 2];
+                    gif_paths[i] = argv[4 + i * 2];
+                }
+                const int status = get_context() != NULL && image_to_gifs(context, argv[2], palette_paths, gif_paths, count) == 1;
+                free(palette_paths);
+                free(gif_paths);
+                if (status != 1) {
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
             fprintf(stderr, "Incorrect number of arguments\n");
             return EXIT_FAILURE;
     }
 
+#if defined(LZW_STATS) || defined(ALLOC_STATS)
+    if (show_stats) {
+        print_stats();
+    }
+#endif
+
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char *argv[]) {
+    // Sync every mode's outputs together, rather than one file at a time
+    output_begin_group();
+    const int status = run(argc, argv);
+    context_free(context);
+    int trace_status = trace_finish();
+
+    // Rename outputs still staged into place and make them durable
+    if (output_end_group() != 1 || trace_status != 1) {
+        return EXIT_FAILURE;
+    }
+
+    return status;
+}
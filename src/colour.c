@@ -0,0 +1,178 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "colour.h"
+
+colour_map *colour_map_new(const uint8_t *palette) {
+    // Cube starts zeroed, so every colour is searched on first use
+    colour_map *map = calloc(1, sizeof(*map));
+    if (map == NULL) {
+        return NULL;
+    }
+
+    // Store target palette scaled back to 6-bit values
+    kernel_scale_down(map->palette, palette, 768);
+
+    return map;
+}
+
+void colour_map_set_palette(colour_map *map, const uint8_t *palette) {
+    uint8_t scaled[768];
+    kernel_scale_down(scaled, palette, 768);
+
+    // Forget nearest colours only if the palette has changed
+    if (memcmp(scaled, map->palette, 768) != 0) {
+        memcpy(map->palette, scaled, 768);
+        memset(map->cube, 0, sizeof(map->cube));
+    }
+}
+
+static uint8_t search_nearest(const colour_map *map, int red, int green, int blue) {
+    // Find palette entry with the smallest squared distance, preferring the lowest index
+    int nearest = 0;
+    int nearest_distance = 3 * 64 * 64;
+    for (int i = 0; i < 256 && nearest_distance > 0; i++) {
+        const int red_delta = map->palette[i * 3] - red;
+        const int green_delta = map->palette[i * 3 + 1] - green;
+        const int blue_delta = map->palette[i * 3 + 2] - blue;
+        const int distance = red_delta * red_delta + green_delta * green_delta + blue_delta * blue_delta;
+        if (distance < nearest_distance) {
+            nearest = i;
+            nearest_distance = distance;
+        }
+    }
+    return nearest;
+}
+
+uint8_t colour_map_nearest(colour_map *map, uint8_t red, uint8_t green, uint8_t blue) {
+    // Palette values are 6-bit, so nothing finer is needed to key the cube
+    red /= 4;
+    green /= 4;
+    blue /= 4;
+    uint16_t *cell = &map->cube[(red << 12) | (green << 6) | blue];
+    if (*cell == 0) {
+        *cell = search_nearest(map, red, green, blue) + 1;
+    }
+    return *cell - 1;
+}
+
+int colour_map_remap_table(colour_map *map, uint8_t *table, const uint8_t *source_palette, int source_size) {
+    int identity = 1;
+    for (int i = 0; i < 256; i++) {
+        if (i >= source_size) {
+            // Indices outside the source palette should never occur, so leave them alone
+            table[i] = i;
+            continue;
+        }
+
+        // Keep the index if it already holds the colour, as palettes often repeat colours
+        const uint8_t *colour = &source_palette[i * 3];
+        if (colour[0] / 4 == map->palette[i * 3] && colour[1] / 4 == map->palette[i * 3 + 1] && colour[2] / 4 == map->palette[i * 3 + 2]) {
+            table[i] = i;
+        } else {
+            table[i] = colour_map_nearest(map, colour[0], colour[1], colour[2]);
+            identity &= table[i] == i;
+        }
+    }
+    return identity;
+}
+
+void colour_map_free(colour_map *map) {
+    free(map);
+}
+
+static inline uint8_t clamp_colour(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static void quantise_floyd_steinberg(colour_map *map, uint8_t *destination, const uint8_t *rgb, int width, int height, int *errors) {
+    // Errors are kept in sixteenths for the current and next row, with a pixel of padding either side
+    const int row_size = (width + 2) * 3;
+    for (int y = 0; y < height; y++) {
+        int *current = &errors[(y & 1) * row_size];
+        int *next = &errors[((y + 1) & 1) * row_size];
+        memset(next, 0, row_size * sizeof(int));
+        for (int x = 0; x < width; x++) {
+            const uint8_t *pixel = &rgb[(y * width + x) * 3];
+            int *error = &current[(x + 1) * 3];
+            const uint8_t red = clamp_colour(pixel[0] + error[0] / 16);
+            const uint8_t green = clamp_colour(pixel[1] + error[1] / 16);
+            const uint8_t blue = clamp_colour(pixel[2] + error[2] / 16);
+            const uint8_t index = colour_map_nearest(map, red, green, blue);
+            destination[y * width + x] = index;
+
+            // Diffuse error to the right and to the row below
+            const int deltas[3] = {
+                red - map->palette[index * 3] * 4,
+                green - map->palette[index * 3 + 1] * 4,
+                blue - map->palette[index * 3 + 2] * 4
+            };
+            for (int c = 0; c < 3; c++) {
+                current[(x + 2) * 3 + c] += deltas[c] * 7;
+                next[x * 3 + c] += deltas[c] * 3;
+                next[(x + 1) * 3 + c] += deltas[c] * 5;
+                next[(x + 2) * 3 + c] += deltas[c];
+            }
+        }
+    }
+}
+
+static void quantise_ordered(colour_map *map, uint8_t *destination, const uint8_t *rgb, int width, int height) {
+    // 4x4 Bayer matrix, giving offsets of -15 to +15
+    static const int8_t bayer[4][4] = {
+        {0, 8, 2, 10},
+        {12, 4, 14, 6},
+        {3, 11, 1, 9},
+        {15, 7, 13, 5}
+    };
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const uint8_t *pixel = &rgb[(y * width + x) * 3];
+            const int offset = bayer[y & 3][x & 3] * 2 - 15;
+            destination[y * width + x] = colour_map_nearest(map, clamp_colour(pixel[0] + offset), clamp_colour(pixel[1] + offset), clamp_colour(pixel[2] + offset));
+        }
+    }
+}
+
+int quantise_rgb(colour_map *map, uint8_t *destination, const uint8_t *rgb, int width, int height, dither_mode dither) {
+    switch (dither) {
+        case DITHER_FLOYD_STEINBERG:
+            if (width > COLOUR_MAX_WIDTH) {
+                return 0;
+            }
+            memset(map->errors, 0, 2 * (width + 2) * 3 * sizeof(int));
+            quantise_floyd_steinberg(map, destination, rgb, width, height, map->errors);
+            break;
+
+        case DITHER_ORDERED:
+            quantise_ordered(map, destination, rgb, width, height);
+            break;
+
+        default:
+            for (int i = 0; i < width * height; i++) {
+                destination[i] = colour_map_nearest(map, rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]);
+            }
+    }
+
+    return 1;
+}
+
+void remap_indices(uint8_t *destination, const uint8_t *source, size_t size, const uint8_t *table) {
+    // Table stays in L1 cache, so this runs close to memcpy speed
+    for (size_t i = 0; i < size; i++) {
+        destination[i] = table[source[i]];
+    }
+}
+
+void expand_palette(uint8_t *destination, const uint8_t *source, size_t size, const uint8_t *palette, int channels) {
+    // Pack every colour into one word, opaque where there is an alpha channel
+    uint32_t colours[256];
+    for (int i = 0; i < 256; i++) {
+        const uint8_t colour[4] = {palette[i * 3], palette[i * 3 + 1], palette[i * 3 + 2], 255};
+        memcpy(&colours[i], colour, 4);
+    }
+    kernel_expand(destination, source, size, colours, channels);
+}
@@ -0,0 +1,155 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "compare.h"
+#include "image.h"
+
+// Set compile-time constants
+#define CHANGED_INDEX 255
+
+static uint64_t load_word(const uint8_t *data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+static uint8_t channel_delta(const uint8_t a, const uint8_t b) {
+    return a > b ? a - b : b - a;
+}
+
+static void make_delta_table(uint8_t *deltas, const uint8_t *first_palette, const uint8_t *second_palette) {
+    // Largest channel difference between every pair of colours
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            uint8_t delta = channel_delta(first_palette[a * 3], second_palette[b * 3]);
+            for (int channel = 1; channel < 3; channel++) {
+                const uint8_t channel_change = channel_delta(first_palette[a * 3 + channel], second_palette[b * 3 + channel]);
+                delta = channel_change > delta ? channel_change : delta;
+            }
+            deltas[a << 8 | b] = delta;
+        }
+    }
+}
+
+static int write_diff(const char *diff_path, const uint8_t *first, const uint8_t *second, const uint8_t *first_palette, const uint8_t *deltas, const uint16_t width, const uint16_t height) {
+    // Dim grey ramp for unchanged pixels, and red for changed pixels
+    uint8_t palette[COL_SIZE];
+    for (int i = 0; i < CHANGED_INDEX; i++) {
+        palette[i * 3] = palette[i * 3 + 1] = palette[i * 3 + 2] = i / 2;
+    }
+    palette[CHANGED_INDEX * 3] = 255;
+    palette[CHANGED_INDEX * 3 + 1] = palette[CHANGED_INDEX * 3 + 2] = 0;
+
+    // Show unchanged pixels by their luminance in the first image
+    const size_t size = (size_t) width * height;
+    uint8_t *diff = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        if (first[i] != second[i] || deltas[first[i] << 8 | second[i]] != 0) {
+            diff[i] = CHANGED_INDEX;
+        } else {
+            const uint8_t *colour = &first_palette[first[i] * 3];
+            diff[i] = (colour[0] * 77 + colour[1] * 150 + colour[2] * 29) * (CHANGED_INDEX - 1) / (255 * 256);
+        }
+    }
+
+    // Encode diff image
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), diff_path);
+    ge_GIF *gif = ge_new_gif_stream(temp_path, width, height, palette, 8, -1);
+    if (gif == NULL) {
+        free(diff);
+        fprintf(stderr, "Error creating diff gif\n");
+        return 0;
+    }
+    ge_begin_frame(gif, 0);
+    ge_put_rows(gif, diff, height);
+    ge_end_frame(gif);
+    const int encode_status = !gif->error;
+    ge_close_gif(gif);
+    free(diff);
+    if (encode_status != 1) {
+        output_abort(temp_path);
+        fprintf(stderr, "Error creating diff gif\n");
+        return 0;
+    }
+
+    return output_commit(temp_path, diff_path);
+}
+
+int compare_images(const char *first_path, const char *second_path, const char *palette_path, const char *diff_path, compare_result *result) {
+    // Load both images
+    uint8_t *first_palette = malloc(COL_SIZE);
+    uint8_t *second_palette = malloc(COL_SIZE);
+    uint8_t *first = malloc(MPH_SIZE);
+    uint8_t *second = malloc(MPH_SIZE);
+    uint8_t *deltas = malloc(256 * 256);
+    uint16_t width, height, second_width, second_height;
+    int status = load_image(first_path, palette_path, first_palette, first, &width, &height) == 1 && load_image(second_path, palette_path, second_palette, second, &second_width, &second_height) == 1;
+    if (status == 1 && (width != second_width || height != second_height)) {
+        fprintf(stderr, "Images differ in size\n");
+        status = 0;
+    }
+    if (status != 1) {
+        free(first_palette);
+        free(second_palette);
+        free(first);
+        free(second);
+        free(deltas);
+        return 0;
+    }
+    make_delta_table(deltas, first_palette, second_palette);
+    memset(result, 0, sizeof(*result));
+    result->width = width;
+    result->height = height;
+    result->left = width;
+    result->top = height;
+
+    // Count index changes branch-free, so the compiler vectorises the loop
+    const size_t size = (size_t) width * height;
+    uint32_t index_changes = 0;
+    for (size_t i = 0; i < size; i++) {
+        index_changes += first[i] != second[i];
+    }
+    result->index_changes = index_changes;
+
+    // Equal indices are equal colours when palettes match, so skip equal words of eight pixels
+    const int same_palette = memcmp(first_palette, second_palette, COL_SIZE) == 0;
+    for (uint16_t y = 0; y < height; y++) {
+        const uint8_t *first_row = &first[y * width];
+        const uint8_t *second_row = &second[y * width];
+        for (uint16_t x = 0; x < width; x++) {
+            if (same_palette && x % 8 == 0 && x + 8 <= width && load_word(&first_row[x]) == load_word(&second_row[x])) {
+                x += 7;
+                continue;
+            }
+            const uint8_t delta = deltas[first_row[x] << 8 | second_row[x]];
+            if (delta == 0 && first_row[x] == second_row[x]) {
+                continue;
+            }
+
+            // Record changed pixel
+            result->changed++;
+            result->colour_changes += delta != 0;
+            result->max_delta = delta > result->max_delta ? delta : result->max_delta;
+            result->left = x < result->left ? x : result->left;
+            result->right = x > result->right ? x : result->right;
+            result->top = y < result->top ? y : result->top;
+            result->bottom = y;
+        }
+    }
+
+    // Write diff image
+    if (diff_path != NULL) {
+        status = write_diff(diff_path, first, second, first_palette, deltas, width, height);
+    }
+    free(first_palette);
+    free(second_palette);
+    free(first);
+    free(second);
+    free(deltas);
+
+    return status;
+}
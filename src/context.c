@@ -0,0 +1,41 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "context.h"
+
+convert_context *context_new(void) {
+    convert_context *context = calloc(1, sizeof(*context));
+    if (context == NULL) {
+        return NULL;
+    }
+    context->encoder = ge_new_arena();
+    context->decoder = gd_new_arena();
+    if (context->encoder == NULL || context->decoder == NULL) {
+        context_free(context);
+        return NULL;
+    }
+    return context;
+}
+
+colour_map *context_colour_map(convert_context *context, const uint8_t *palette) {
+    // Keep one map, so nearest colours already searched carry over while the palette is unchanged
+    if (context->map == NULL) {
+        context->map = colour_map_new(palette);
+    } else {
+        colour_map_set_palette(context->map, palette);
+    }
+    return context->map;
+}
+
+void context_free(convert_context *context) {
+    if (context == NULL) {
+        return;
+    }
+    ge_del_arena(context->encoder);
+    gd_del_arena(context->decoder);
+    colour_map_free(context->map);
+    free(context);
+}
@@ -0,0 +1,132 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "dedup.h"
+#include "cache.h"
+
+// Set compile-time constants
+#define CHUNK_SIZE 65536
+
+typedef struct keyed_entry {
+    uint64_t key;
+    int index;
+} keyed_entry;
+
+static int compare_keys(const void *a, const void *b) {
+    const keyed_entry *first = a;
+    const keyed_entry *second = b;
+    if (first->key != second->key) {
+        return first->key < second->key ? -1 : 1;
+    }
+
+    // Keep manifest order within equal keys, so the earliest entry becomes canonical
+    return first->index - second->index;
+}
+
+static int files_equal(const char *first_path, const char *second_path) {
+    if (strcmp(first_path, second_path) == 0) {
+        return 1;
+    }
+
+    // Open both files
+    FILE *first_pointer = fopen(first_path, "rb");
+    if (first_pointer == NULL) {
+        return 0;
+    }
+    FILE *second_pointer = fopen(second_path, "rb");
+    if (second_pointer == NULL) {
+        fclose(first_pointer);
+        return 0;
+    }
+
+    // Compare file contents in chunks
+    uint8_t *first_chunk = malloc(CHUNK_SIZE);
+    uint8_t *second_chunk = malloc(CHUNK_SIZE);
+    int equal = 1;
+    size_t read_size;
+    do {
+        read_size = fread(first_chunk, 1, CHUNK_SIZE, first_pointer);
+        if (fread(second_chunk, 1, CHUNK_SIZE, second_pointer) != read_size || memcmp(first_chunk, second_chunk, read_size) != 0) {
+            equal = 0;
+        }
+    } while (equal && read_size == CHUNK_SIZE);
+    if (ferror(first_pointer) || ferror(second_pointer)) {
+        equal = 0;
+    }
+    fclose(first_pointer);
+    fclose(second_pointer);
+    free(first_chunk);
+    free(second_chunk);
+
+    return equal;
+}
+
+static int same_inputs(const manifest_entry *first, const manifest_entry *second) {
+    if ((first->palette == NULL) != (second->palette == NULL)) {
+        return 0;
+    }
+    return files_equal(first->source, second->source) && (first->palette == NULL || files_equal(first->palette, second->palette));
+}
+
+int *dedup_manifest(const manifest *list) {
+    // Every entry is canonical until shown to duplicate an earlier one
+    int *canonical = malloc(list->count * sizeof(int));
+    keyed_entry *keys = malloc(list->count * sizeof(keyed_entry));
+    int key_count = 0;
+    for (int i = 0; i < list->count; i++) {
+        canonical[i] = i;
+
+        // Hash source and palette contents, leaving unreadable inputs to fail in conversion
+        if (cache_key(&keys[key_count].key, 'm', "", list->entries[i].source, list->entries[i].palette) == 1) {
+            keys[key_count].index = i;
+            key_count++;
+        }
+    }
+
+    // Group equal hashes, then confirm contents so a collision never links unrelated outputs
+    qsort(keys, key_count, sizeof(keyed_entry), compare_keys);
+    for (int start = 0, end; start < key_count; start = end) {
+        for (end = start + 1; end < key_count && keys[end].key == keys[start].key; end++) {
+            const int index = keys[end].index;
+            for (int i = start; i < end; i++) {
+                const int candidate = keys[i].index;
+                if (canonical[candidate] == candidate && same_inputs(&list->entries[candidate], &list->entries[index])) {
+                    canonical[index] = candidate;
+                    break;
+                }
+            }
+        }
+    }
+    free(keys);
+
+    return canonical;
+}
+
+int dedup_report(const char *report_path, const manifest *list, const int *canonical) {
+    // Create report file
+    FILE *report_pointer = fopen(report_path, "w");
+    if (report_pointer == NULL) {
+        fprintf(stderr, "Error creating report file\n");
+        return 0;
+    }
+
+    // List each duplicate with the output it was linked to
+    int duplicates = 0;
+    fprintf(report_pointer, "# source,destination,canonical destination\n");
+    for (int i = 0; i < list->count; i++) {
+        if (canonical[i] != i) {
+            fprintf(report_pointer, "%s,%s,%s\n", list->entries[i].source, list->entries[i].destination, list->entries[canonical[i]].destination);
+            duplicates++;
+        }
+    }
+    fprintf(report_pointer, "# %d of %d entries were duplicates\n", duplicates, list->count);
+    if (fclose(report_pointer) != 0) {
+        fprintf(stderr, "Error writing report file\n");
+        return 0;
+    }
+
+    return 1;
+}
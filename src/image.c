@@ -7,10 +7,40 @@
 #include "image.h"
 
 // Set compile-time constants
-#define COL_SIZE 768
-#define TM_SIZE 49152
-#define RAW_SIZE 64768
-#define MPH_SIZE 65536
+#define GIF_PALETTE_OFFSET 13
+
+#ifdef LZW_STATS
+// LZW counters of conversions run on this thread
+static _Thread_local ge_Stats encoder_stats;
+static _Thread_local gd_Stats decoder_stats;
+
+static void add_counters(uint64_t *total, const uint64_t *counters, const size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        total[i] += counters[i];
+    }
+}
+
+static void record_encoder_stats(const ge_GIF *gif) {
+    add_counters((uint64_t *) &encoder_stats, (const uint64_t *) &gif->stats, sizeof(ge_Stats) / sizeof(uint64_t));
+}
+
+static void record_decoder_stats(const gd_GIF *gif) {
+    add_counters((uint64_t *) &decoder_stats, (const uint64_t *) &gif->stats, sizeof(gd_Stats) / sizeof(uint64_t));
+}
+
+void image_lzw_stats(ge_Stats *encoder, gd_Stats *decoder) {
+    *encoder = encoder_stats;
+    *decoder = decoder_stats;
+}
+
+void image_reset_lzw_stats(void) {
+    memset(&encoder_stats, 0, sizeof(encoder_stats));
+    memset(&decoder_stats, 0, sizeof(decoder_stats));
+}
+#else
+#define record_encoder_stats(gif) ((void) 0)
+#define record_decoder_stats(gif) ((void) 0)
+#endif
 
 static size_t get_file_size(FILE *file_pointer) {
     fseek(file_pointer, 0, SEEK_END);
@@ -19,148 +49,252 @@ static size_t get_file_size(FILE *file_pointer) {
     return file_size;
 }
 
-static int write_gif(const char *gif_path, const uint8_t *image_data, const uint16_t image_width, const uint16_t image_height, uint8_t *palette) {
-    ge_GIF *gif = ge_new_gif(gif_path, image_width, image_height, palette, 8, -1);
+static int write_gif(convert_context *context, const char *gif_path, const uint8_t *image_data, const uint16_t image_width, const uint16_t image_height, uint8_t *palette) {
+    // Stream rows straight into the encoder, as a single frame needs no buffers
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), gif_path);
+    ge_GIF *gif = ge_new_gif_stream_arena(temp_path, image_width, image_height, palette, 8, -1, context->encoder);
     if(gif == NULL) {
         return 0;
     }
-    memcpy(gif->frame, image_data, image_width * image_height);
-    ge_add_frame(gif, 0);
+    ge_begin_frame(gif, 0);
+    ge_put_rows(gif, image_data, image_height);
+    ge_end_frame(gif);
+    record_encoder_stats(gif);
+    const int encode_status = !gif->error;
     ge_close_gif(gif);
+    if (encode_status != 1) {
+        output_abort(temp_path);
+        return 0;
+    }
+
+    // Rename complete gif into place
+    return output_commit(temp_path, gif_path);
+}
+
+// Open a file read or written in whole blocks, leaving stdio no buffer of its own to allocate
+static FILE *open_unbuffered(const char *path, const char *mode) {
+    FILE *file_pointer = fopen(path, mode);
+    if (file_pointer != NULL) {
+        setvbuf(file_pointer, NULL, _IONBF, 0);
+    }
+    return file_pointer;
+}
+
+static int write_image(const char *image_path, const uint8_t *palette, const uint8_t *image_data, const size_t image_size) {
+    // Open temporary image, so a partial image never replaces the output
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), image_path);
+    FILE *image_pointer = NULL;
+    if ((image_pointer = open_unbuffered(temp_path, "wb")) == NULL) {
+        fprintf(stderr, "Error creating image file\n");
+        return 0;
+    }
+
+    // Write colour palette to file
+    if (palette != NULL && fwrite(palette, COL_SIZE, 1, image_pointer) != 1) {
+        fclose(image_pointer);
+        output_abort(temp_path);
+        fprintf(stderr, "Error writing image data to file\n");
+        return 0;
+    }
+
+    // Write image data to file
+    int write_status = image_size == 0 || fwrite(image_data, image_size, 1, image_pointer) == 1;
+    if (fclose(image_pointer) != 0) {
+        write_status = 0;
+    }
+    if (write_status != 1) {
+        output_abort(temp_path);
+        fprintf(stderr, "Error writing image data to file\n");
+        return 0;
+    }
+
+    // Rename complete image into place
+    return output_commit(temp_path, image_path);
+}
+
+static int scale_palette_up(uint8_t *palette) {
+    // Check colour values, then multiply them by 4 to scale to 256 colours
+    if (kernel_scale_up(palette, COL_SIZE) != 1) {
+        fprintf(stderr, "Unsupported colour palette value\n");
+        return 0;
+    }
+
     return 1;
 }
 
-int col_to_gif(FILE *file_pointer, const char *gif_path) {
+static void scale_palette_down(uint8_t *palette, const uint8_t *colors) {
+    // Divide by 4 to scale to 64 colours
+    kernel_scale_down(palette, colors, COL_SIZE);
+}
+
+static void make_heightmap_palette(uint8_t *palette) {
+    for (int i = 0; i < 256; i++) {
+        const int j = i * 3;
+        palette[j] = i;
+        palette[j + 1] = i + 1;
+        palette[j + 2] = i + 2;
+    }
+}
+
+int col_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path) {
     // Read embedded colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    if (read_palette(palette, file_pointer) != 1) {
+    if (read_palette(context->palette, file_pointer) != 1) {
         fclose(file_pointer);
-        free(palette);
         return 0;
     }
     fclose(file_pointer);
 
     // Create image data
-    uint8_t *image_data = malloc(256);
     for (int i = 0; i < 256; i++) {
-        image_data[i] = i;
+        context->image_data[i] = i;
     }
 
     // Create GIF
-    if (write_gif(gif_path, image_data, 16, 16, palette) != 1) {
-        free(palette);
-        free(image_data);
+    if (write_gif(context, gif_path, context->image_data, 16, 16, context->palette) != 1) {
         fprintf(stderr, "Could not create gif\n");
         return 0;
     }
-    free(palette);
-    free(image_data);
 
     return 1;
 }
 
-int mph_to_gif(FILE *file_pointer, const char *gif_path) {
+int mph_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path) {
     // Create greyscale colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    for (int i = 0; i < 256; i++) {
-        const int j = i * 3;
-        palette[j] = i;
-        palette[j + 1] = i + 1;
-        palette[j + 2] = i + 2;
-    }
+    make_heightmap_palette(context->palette);
 
     // Read image data
-    uint8_t *image_data = malloc(MPH_SIZE);
-    if (fread(image_data, MPH_SIZE, 1, file_pointer) != 1) {
+    if (fread(context->image_data, MPH_SIZE, 1, file_pointer) != 1) {
         fclose(file_pointer);
-        free(palette);
-        free(image_data);
         fprintf(stderr, "Could not read image\n");
         return 0;
     }
     fclose(file_pointer);
 
     // Write GIF
-    if (write_gif(gif_path, image_data, 256, 256, palette) != 1) {
-        free(palette);
-        free(image_data);
+    if (write_gif(context, gif_path, context->image_data, 256, 256, context->palette) != 1) {
         fprintf(stderr, "Could not create gif\n");
         return 0;
     }
-    free(palette);
-    free(image_data);
 
     return 1;
 }
 
-int raw_to_gif(FILE *file_pointer, const char *gif_path) {
+int raw_to_gif(convert_context *context, FILE *file_pointer, const char *gif_path) {
     // Read embedded colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    if (read_palette(palette, file_pointer) != 1) {
+    if (read_palette(context->palette, file_pointer) != 1) {
         fclose(file_pointer);
-        free(palette);
         return 0;
     }
 
     // Read image data
-    uint8_t *image_data = malloc(RAW_SIZE - COL_SIZE);
-    if (fread(image_data, RAW_SIZE - COL_SIZE, 1, file_pointer) != 1) {
+    if (fread(context->image_data, RAW_SIZE - COL_SIZE, 1, file_pointer) != 1) {
         fclose(file_pointer);
-        free(palette);
-        free(image_data);
         fprintf(stderr, "Could not read image\n");
         return 0;
     }
     fclose(file_pointer);
 
     // Write GIF
-    if (write_gif(gif_path, image_data, 320, 200, palette) != 1) {
-        free(palette);
-        free(image_data);
+    if (write_gif(context, gif_path, context->image_data, 320, 200, context->palette) != 1) {
         fprintf(stderr, "Could not create gif\n");
         return 0;
     }
-    free(palette);
-    free(image_data);
 
     return 1;
 }
 
-int tm_to_gif(FILE *file_pointer, const char *palette_path, const char *gif_path) {
+int tm_to_gif(convert_context *context, FILE *file_pointer, const char *palette_path, const char *gif_path) {
     // Read external colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    if (read_palette_from_file(palette, palette_path) != 1) {
-        free(palette);
+    if (read_palette_from_file(context->palette, palette_path) != 1) {
+        fclose(file_pointer);
         return 0;
     }
 
     // Read image data
-    uint8_t *image_data = malloc(TM_SIZE);
-    if (fread(image_data, TM_SIZE, 1, file_pointer) != 1) {
+    if (fread(context->image_data, TM_SIZE, 1, file_pointer) != 1) {
         fclose(file_pointer);
-        free(palette);
-        free(image_data);
         fprintf(stderr, "Could not read image\n");
         return 0;
     }
     fclose(file_pointer);
 
     // Write GIF
-    if (write_gif(gif_path, image_data, 256, 192, palette) != 1) {
-        free(palette);
-        free(image_data);
+    if (write_gif(context, gif_path, context->image_data, 256, 192, context->palette) != 1) {
         fprintf(stderr, "Could not create gif\n");
         return 0;
     }
-    free(palette);
-    free(image_data);
 
     return 1;
 }
 
-int image_to_gif(const char *image_path, const char *palette_path, const char *gif_path) {
+int tm_to_gifs(convert_context *context, FILE *file_pointer, const char **palette_paths, const char **gif_paths, const int count) {
+    // Read image data
+    if (fread(context->image_data, TM_SIZE, 1, file_pointer) != 1) {
+        fclose(file_pointer);
+        fprintf(stderr, "Could not read image\n");
+        return 0;
+    }
+    fclose(file_pointer);
+
+    // Read first colour palette
+    if (read_palette_from_file(context->palette, palette_paths[0]) != 1) {
+        return 0;
+    }
+
+    // Compress image data once into memory held by the arena
+    ge_GIF *gif = ge_new_gif_stream_arena(NULL, 256, 192, context->palette, 8, -1, context->encoder);
+    if (gif == NULL) {
+        fprintf(stderr, "Could not create gif\n");
+        return 0;
+    }
+    ge_begin_frame(gif, 0);
+    ge_put_rows(gif, context->image_data, 192);
+    ge_end_frame(gif);
+    record_encoder_stats(gif);
+    size_t gif_size;
+    uint8_t *gif_data = ge_close_gif_mem(gif, &gif_size);
+    if (gif_data == NULL) {
+        fprintf(stderr, "Could not create gif\n");
+        return 0;
+    }
+
+    // Write one gif per colour palette, swapping only the global colour table
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && read_palette_from_file(context->palette, palette_paths[i]) != 1) {
+            return 0;
+        }
+        memcpy(&gif_data[GIF_PALETTE_OFFSET], context->palette, COL_SIZE);
+        if (write_image(gif_paths[i], NULL, gif_data, gif_size) != 1) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int image_to_gifs(convert_context *context, const char *image_path, const char **palette_paths, const char **gif_paths, const int count) {
+    // Open image file
+    FILE *image_pointer = open_unbuffered(image_path, "rb");
+    if (image_pointer == NULL) {
+        fprintf(stderr, "Error opening image\n");
+        return 0;
+    }
+
+    // Only .TM images take an external colour palette
+    if (get_file_size(image_pointer) != TM_SIZE) {
+        fclose(image_pointer);
+        fprintf(stderr, "Unsupported image type or size\n");
+        return 0;
+    }
+
+    return tm_to_gifs(context, image_pointer, palette_paths, gif_paths, count);
+}
+
+int image_to_gif(convert_context *context, const char *image_path, const char *palette_path, const char *gif_path) {
     // Open image file
-    FILE *image_pointer = fopen(image_path, "rb");
+    FILE *image_pointer = open_unbuffered(image_path, "rb");
     if (image_pointer == NULL) {
         fprintf(stderr, "Error opening image\n");
         return 0;
@@ -171,7 +305,7 @@ int image_to_gif(const char *image_path, const char *palette_path, const char *g
     switch (file_size) {
         // .TM image
         case TM_SIZE:
-            return tm_to_gif(image_pointer, palette_path, gif_path);
+            return tm_to_gif(context, image_pointer, palette_path, gif_path);
 
         default:
             fclose(image_pointer);
@@ -180,9 +314,9 @@ int image_to_gif(const char *image_path, const char *palette_path, const char *g
     }
 }
 
-int embedded_image_to_gif(const char *image_path, const char *gif_path) {
+int embedded_image_to_gif(convert_context *context, const char *image_path, const char *gif_path) {
     // Open image file
-    FILE *image_pointer = fopen(image_path, "rb");
+    FILE *image_pointer = open_unbuffered(image_path, "rb");
     if (image_pointer == NULL) {
         fprintf(stderr, "Error opening image\n");
         return 0;
@@ -193,15 +327,15 @@ int embedded_image_to_gif(const char *image_path, const char *gif_path) {
     switch (file_size) {
         // .COL colour palette
         case COL_SIZE:
-            return col_to_gif(image_pointer, gif_path);
+            return col_to_gif(context, image_pointer, gif_path);
 
         // .MPH heightmap
         case MPH_SIZE:
-            return mph_to_gif(image_pointer, gif_path);
+            return mph_to_gif(context, image_pointer, gif_path);
 
         // .RAW image
         case RAW_SIZE:
-            return raw_to_gif(image_pointer, gif_path);
+            return raw_to_gif(context, image_pointer, gif_path);
 
         default:
             fclose(image_pointer);
@@ -210,180 +344,294 @@ int embedded_image_to_gif(const char *image_path, const char *gif_path) {
     }
 }
 
-int gif_to_col(gd_GIF *gif, const char *image_path) {
-    // Check palette size
-    if (gif->palette->size != 256) {
-        fprintf(stderr, "Unsupported colour palette size\n");
+static int load_gif(const char *gif_path, uint8_t *palette, uint8_t *image_data, uint16_t *width, uint16_t *height) {
+    // Open gif file, without the RGB canvas as only palette indices are needed
+    gd_GIF *gif = gd_open_gif_flags(gif_path, GD_NO_CANVAS);
+    if (gif == NULL) {
+        fprintf(stderr, "Error opening gif\n");
         return 0;
     }
 
-    // Read colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    memcpy(palette, gif->palette->colors, COL_SIZE);
+    // Reject sizes of no game format before decoding any image data
+    const int gif_size = gif->width * gif->height;
+    if (gif_size != 256 && gif_size != TM_SIZE && gif_size != RAW_SIZE - COL_SIZE && gif_size != MPH_SIZE) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif size\n");
+        return 0;
+    }
+
+    // Check gif frame
+    const int frame_status = gd_get_frame(gif);
+    record_decoder_stats(gif);
+    if (frame_status != 1) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif frame\n");
+        return 0;
+    }
+
+    // Copy colour palette of the frame, and its indices
+    memset(palette, 0, COL_SIZE);
+    memcpy(palette, gif->palette->colors, gif->palette->size * 3);
+    memcpy(image_data, gif->frame, gif_size);
+    *width = gif->width;
+    *height = gif->height;
     gd_close_gif(gif);
 
-    // Scale palette colour values
-    for (int i = 0; i < COL_SIZE; i++) {
-        // Divide by 4 to scale to 64 colours
-        palette[i] /= 4;
+    return 1;
+}
+
+int load_image(const char *image_path, const char *palette_path, uint8_t *palette, uint8_t *image_data, uint16_t *width, uint16_t *height) {
+    // Gifs carry their own colour palette
+    if (is_gif(image_path)) {
+        return load_gif(image_path, palette, image_data, width, height);
     }
 
-    // Open image
-    FILE *image_pointer = NULL;
-    if ((image_pointer = fopen(image_path, "wb")) == NULL) {
-        free(palette);
-        fprintf(stderr, "Error creating image file\n");
+    // Open image file
+    FILE *image_pointer = open_unbuffered(image_path, "rb");
+    if (image_pointer == NULL) {
+        fprintf(stderr, "Error opening image\n");
         return 0;
     }
 
-    // Write image data to file
-    int write_status = fwrite(palette, COL_SIZE, 1, image_pointer);
-    fclose(image_pointer);
-    free(palette);
-    if (write_status != 1) {
-        fprintf(stderr, "Error writing image data to file\n");
+    // Get file size to determine file type
+    size_t image_size;
+    switch (get_file_size(image_pointer)) {
+        // .COL colour palette, shown as every colour in turn
+        case COL_SIZE:
+            if (read_palette(palette, image_pointer) != 1) {
+                fclose(image_pointer);
+                return 0;
+            }
+            fclose(image_pointer);
+            for (int i = 0; i < 256; i++) {
+                image_data[i] = i;
+            }
+            *width = 16;
+            *height = 16;
+            return 1;
+
+        // .TM image
+        case TM_SIZE:
+            if (palette_path == NULL) {
+                fclose(image_pointer);
+                fprintf(stderr, "Image requires a colour palette\n");
+                return 0;
+            }
+            if (read_palette_from_file(palette, palette_path) != 1) {
+                fclose(image_pointer);
+                return 0;
+            }
+            *width = 256;
+            *height = 192;
+            image_size = TM_SIZE;
+            break;
+
+        // .RAW image
+        case RAW_SIZE:
+            if (read_palette(palette, image_pointer) != 1) {
+                fclose(image_pointer);
+                return 0;
+            }
+            *width = 320;
+            *height = 200;
+            image_size = RAW_SIZE - COL_SIZE;
+            break;
+
+        // .MPH heightmap
+        case MPH_SIZE:
+            make_heightmap_palette(palette);
+            *width = 256;
+            *height = 256;
+            image_size = MPH_SIZE;
+            break;
+
+        default:
+            fclose(image_pointer);
+            fprintf(stderr, "Unsupported image type or size\n");
+            return 0;
+    }
+
+    // Read image data
+    if (fread(image_data, image_size, 1, image_pointer) != 1) {
+        fclose(image_pointer);
+        fprintf(stderr, "Could not read image\n");
         return 0;
     }
+    fclose(image_pointer);
 
     return 1;
 }
 
-int gif_to_mph(gd_GIF *gif, const char *image_path) {
-    // Check palette size
-    if (gif->palette->size != 256) {
-        fprintf(stderr, "Unsupported colour palette size\n");
+int images_to_gif(convert_context *context, const char **image_paths, const int count, const char *palette_path, const uint16_t delay, const char *gif_path) {
+    // Read first frame, whose colour palette becomes the global one
+    uint8_t *palette = context->palette;
+    uint8_t *frame_palette = context->frame_palette;
+    uint8_t *image_data = context->image_data;
+    uint16_t width, height;
+    if (load_image(image_paths[0], palette_path, palette, image_data, &width, &height) != 1) {
         return 0;
     }
 
-    // Convert gif frame to image
-    uint8_t *image_data = malloc(MPH_SIZE);
-    memcpy(image_data, gif->frame, MPH_SIZE);
-    gd_close_gif(gif);
-
-    // Open image
-    FILE *image_pointer = NULL;
-    if ((image_pointer = fopen(image_path, "wb")) == NULL) {
-        free(image_data);
-        fprintf(stderr, "Error creating image file\n");
+    // Create looping gif in the arena, renamed into place once complete
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), gif_path);
+    ge_GIF *gif = ge_new_gif_arena(temp_path, width, height, palette, 8, 0, context->encoder);
+    if (gif == NULL) {
+        fprintf(stderr, "Could not create gif\n");
         return 0;
     }
 
-    // Write image data to file
-    int write_status = fwrite(image_data, MPH_SIZE, 1, image_pointer);
-    fclose(image_pointer);
-    free(image_data);
-    if (write_status != 1) {
-        fprintf(stderr, "Error writing image data to file\n");
+    // Add frames, each encoded as the rectangle changed from the previous one, with their own colours if they differ
+    memcpy(frame_palette, palette, COL_SIZE);
+    for (int i = 0; i < count; i++) {
+        uint16_t frame_width, frame_height;
+        if (i > 0 && load_image(image_paths[i], palette_path, frame_palette, image_data, &frame_width, &frame_height) != 1) {
+            ge_close_gif(gif);
+            output_abort(temp_path);
+            return 0;
+        }
+        if (i > 0 && (frame_width != width || frame_height != height)) {
+            ge_close_gif(gif);
+            output_abort(temp_path);
+            fprintf(stderr, "Frame sizes do not match\n");
+            return 0;
+        }
+        memcpy(gif->frame, image_data, width * height);
+        ge_add_frame_palette(gif, delay, frame_palette);
+    }
+    record_encoder_stats(gif);
+    const int encode_status = !gif->error;
+    ge_close_gif(gif);
+    if (encode_status != 1) {
+        output_abort(temp_path);
+        fprintf(stderr, "Could not create gif\n");
         return 0;
     }
 
-    return 1;
+    return output_commit(temp_path, gif_path);
 }
 
-int gif_to_raw(gd_GIF *gif, const char *image_path) {
+int gif_to_col(convert_context *context, gd_GIF *gif, const char *image_path) {
     // Check palette size
     if (gif->palette->size != 256) {
+        gd_close_gif(gif);
         fprintf(stderr, "Unsupported colour palette size\n");
         return 0;
     }
 
     // Read colour palette
-    uint8_t *palette = malloc(COL_SIZE);
-    memcpy(palette, gif->palette->colors, COL_SIZE);
+    scale_palette_down(context->palette, gif->palette->colors);
+    gd_close_gif(gif);
 
-    // Scale palette colour values
-    for (int i = 0; i < COL_SIZE; i++) {
-        // Divide by 4 to scale to 64 colours
-        palette[i] /= 4;
+    // Write colour palette to file
+    return write_image(image_path, context->palette, NULL, 0);
+}
+
+int gif_to_mph(convert_context *context, gd_GIF *gif, const char *image_path) {
+    // Check palette size
+    if (gif->palette->size != 256) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported colour palette size\n");
+        return 0;
     }
 
-    // Convert gif frame to image
-    uint8_t *image_data = malloc(RAW_SIZE - COL_SIZE);
-    memcpy(image_data, gif->frame, RAW_SIZE - COL_SIZE);
+    // Write gif frame to file
+    const int write_status = write_image(image_path, NULL, gif->frame, MPH_SIZE);
     gd_close_gif(gif);
 
-    // Open image
-    FILE *image_pointer = NULL;
-    if ((image_pointer = fopen(image_path, "wb")) == NULL) {
-        free(image_data);
-        fprintf(stderr, "Error creating image file\n");
-        return 0;
-    }
+    return write_status;
+}
 
-    // Write colour palette to file
-    int write_status = fwrite(palette, COL_SIZE, 1, image_pointer);
-    free(palette);
-    if (write_status != 1) {
-        fclose(image_pointer);
-        fprintf(stderr, "Error writing image data to file\n");
+int gif_to_raw(convert_context *context, gd_GIF *gif, const char *image_path) {
+    // Check palette size
+    if (gif->palette->size != 256) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported colour palette size\n");
         return 0;
     }
 
-    // Write image data to file
-    write_status = fwrite(image_data, RAW_SIZE - COL_SIZE, 1, image_pointer);
-    fclose(image_pointer);
-    free(image_data);
-    if (write_status != 1) {
-        fprintf(stderr, "Error writing image data to file\n");
-        return 0;
-    }
+    // Read colour palette
+    scale_palette_down(context->palette, gif->palette->colors);
 
-    return 1;
+    // Write colour palette and gif frame to file
+    const int write_status = write_image(image_path, context->palette, gif->frame, RAW_SIZE - COL_SIZE);
+    gd_close_gif(gif);
+
+    return write_status;
 }
 
-int gif_to_tm(gd_GIF *gif, const char *palette_path, const char *image_path) {
+int gif_to_tm(convert_context *context, gd_GIF *gif, const char *palette_path, const char *image_path) {
     // Check palette size
     if (gif->palette->size != 256) {
+        gd_close_gif(gif);
         fprintf(stderr, "Unsupported colour palette size\n");
         return 0;
     }
 
-    // Convert gif frame to image
-    uint8_t *image_data = malloc(TM_SIZE);
-    memcpy(image_data, gif->frame, TM_SIZE);
-    gd_close_gif(gif);
-
-    // Open image
-    FILE *image_pointer = NULL;
-    if ((image_pointer = fopen(image_path, "wb")) == NULL) {
-        free(image_data);
-        fprintf(stderr, "Error creating image file\n");
+    // Read target colour palette
+    if (read_palette_from_file(context->palette, palette_path) != 1) {
+        gd_close_gif(gif);
         return 0;
     }
 
-    // Write image data to file
-    int write_status = fwrite(image_data, TM_SIZE, 1, image_pointer);
-    fclose(image_pointer);
-    free(image_data);
-    if (write_status != 1) {
-        fprintf(stderr, "Error writing image data to file\n");
+    // Map each gif colour to the nearest target colour
+    colour_map *map = context_colour_map(context, context->palette);
+    if (map == NULL) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Could not create colour map\n");
         return 0;
     }
+    uint8_t remap_table[256];
+    const int identity = colour_map_remap_table(map, remap_table, gif->palette->colors, gif->palette->size);
+
+    // Write gif frame to file, remapping it if needed
+    int write_status;
+    if (identity) {
+        write_status = write_image(image_path, NULL, gif->frame, TM_SIZE);
+    } else {
+        remap_indices(context->image_data, gif->frame, TM_SIZE, remap_table);
+        write_status = write_image(image_path, NULL, context->image_data, TM_SIZE);
+    }
+    gd_close_gif(gif);
 
-    return 1;
+    return write_status;
 }
 
-int gif_to_image(const char *gif_path, const char *palette_path, const char *image_path) {
-    // Open gif file
-    gd_GIF *gif = gd_open_gif(gif_path);
-    if(gif == NULL) {
-        fprintf(stderr, "Error opening gif\n");
+int gif_frame_to_image(convert_context *context, gd_GIF *gif, const char *palette_path, const char *image_path) {
+    // Reject unsupported sizes before decoding any image data, as only .TM images take an external palette
+    const int gif_size = gif->width * gif->height;
+    if (palette_path != NULL ? gif_size != TM_SIZE : gif_size != 256 && gif_size != MPH_SIZE && gif_size != RAW_SIZE - COL_SIZE) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif size\n");
         return 0;
     }
 
     // Check gif frame
-    gd_get_frame(gif);
-    if(gif->frame == NULL) {
+    const int frame_status = gd_get_frame(gif);
+    record_decoder_stats(gif);
+    if(frame_status != 1) {
         gd_close_gif(gif);
         fprintf(stderr, "Unsupported gif frame\n");
         return 0;
     }
 
     // Get file size to determine file type
-    switch (gif->width * gif->height) {
+    switch (gif_size) {
         // .TM image
         case TM_SIZE:
-            return gif_to_tm(gif, palette_path, image_path);
+            return gif_to_tm(context, gif, palette_path, image_path);
+
+        // .COL colour palette
+        case 256:
+            return gif_to_col(context, gif, image_path);
+
+        // .MPH heightmap
+        case MPH_SIZE:
+            return gif_to_mph(context, gif, image_path);
+
+        // .RAW image
+        case RAW_SIZE - COL_SIZE:
+            return gif_to_raw(context, gif, image_path);
 
         default:
             gd_close_gif(gif);
@@ -392,68 +640,798 @@ int gif_to_image(const char *gif_path, const char *palette_path, const char *ima
     }
 }
 
-int gif_to_embedded_image(const char *gif_path, const char *image_path) {
-    // Open gif file
-    gd_GIF *gif = gd_open_gif(gif_path);
+int gif_to_image(convert_context *context, const char *gif_path, const char *palette_path, const char *image_path) {
+    // Open gif file, without the RGB canvas as only palette indices are needed
+    gd_GIF *gif = gd_open_gif_arena(gif_path, GD_NO_CANVAS, context->decoder);
     if(gif == NULL) {
         fprintf(stderr, "Error opening gif\n");
         return 0;
     }
 
-    // Check gif frame
-    gd_get_frame(gif);
-    if(gif->frame == NULL) {
-        gd_close_gif(gif);
-        fprintf(stderr, "Unsupported gif frame\n");
-        return 0;
+    return gif_frame_to_image(context, gif, palette_path, image_path);
+}
+
+int gif_to_embedded_image(convert_context *context, const char *gif_path, const char *image_path) {
+    return gif_to_image(context, gif_path, NULL, image_path);
+}
+
+rgb_format get_rgb_format(const char *path) {
+    // Compare extension case-insensitively
+    const char *extension = strrchr(path, '.');
+    if (extension == NULL || strlen(extension) > 5) {
+        return RGB_NONE;
+    }
+    char lower[6] = {0};
+    for (int i = 0; extension[i] != '\0'; i++) {
+        lower[i] = extension[i] >= 'A' && extension[i] <= 'Z' ? extension[i] - 'A' + 'a' : extension[i];
+    }
+    if (strcmp(lower, ".ppm") == 0) {
+        return RGB_PPM;
     }
+    if (strcmp(lower, ".bmp") == 0) {
+        return RGB_BMP;
+    }
+    if (strcmp(lower, ".rgba") == 0) {
+        return RGB_RGBA;
+    }
+    return RGB_NONE;
+}
 
-    // Get file size to determine file type
-    switch (gif->width * gif->height) {
+static void put_le(uint8_t *data, uint32_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        data[i] = value >> (i * 8);
+    }
+}
+
+int image_to_rgb(convert_context *context, const char *image_path, const char *palette_path, const char *output_path, rgb_format format) {
+    // Load indices and scaled colour palette
+    uint8_t *palette = context->palette;
+    uint8_t *image_data = context->image_data;
+    uint16_t width, height;
+    if (load_image(image_path, palette_path, palette, image_data, &width, &height) != 1) {
+        return 0;
+    }
+
+    // Lay out header and pixels in one buffer, which every game format fits as RGBA
+    const size_t pixel_count = (size_t) width * height;
+    size_t header_size = 0;
+    size_t output_size = 0;
+    uint8_t *output = context->rgb;
+    switch (format) {
+        case RGB_PPM: {
+            char header[32];
+            header_size = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+            output_size = header_size + pixel_count * 3;
+            memcpy(output, header, header_size);
+            expand_palette(&output[header_size], image_data, pixel_count, palette, 3);
+            break;
+        }
+
+        case RGB_BMP: {
+            // Bottom-up rows of blue, green and red, each padded to four bytes
+            const size_t row_size = ((size_t) width * 3 + 3) & ~(size_t) 3;
+            header_size = 54;
+            output_size = header_size + row_size * height;
+            memset(output, 0, output_size);
+            output[0] = 'B';
+            output[1] = 'M';
+            put_le(&output[2], output_size, 4);
+            put_le(&output[10], header_size, 4);
+            put_le(&output[14], 40, 4);
+            put_le(&output[18], width, 4);
+            put_le(&output[22], height, 4);
+            put_le(&output[26], 1, 2);
+            put_le(&output[28], 24, 2);
+            put_le(&output[34], row_size * height, 4);
+            for (int i = 0; i < 256; i++) {
+                const uint8_t red = palette[i * 3];
+                palette[i * 3] = palette[i * 3 + 2];
+                palette[i * 3 + 2] = red;
+            }
+            for (uint16_t y = 0; y < height; y++) {
+                expand_palette(&output[header_size + (height - 1 - y) * row_size], &image_data[y * width], width, palette, 3);
+            }
+            break;
+        }
+
+        case RGB_RGBA:
+            output_size = pixel_count * 4;
+            expand_palette(output, image_data, pixel_count, palette, 4);
+            break;
+
+        default:
+            fprintf(stderr, "Unsupported output format\n");
+            return 0;
+    }
+
+    // Write whole file at once
+    return write_image(output_path, NULL, output, output_size);
+}
+
+int split_raw(const char *raw_path, const char *palette_path, const char *pixels_path) {
+    // Open image file
+    FILE *raw_pointer = open_unbuffered(raw_path, "rb");
+    if (raw_pointer == NULL) {
+        fprintf(stderr, "Error opening image\n");
+        return 0;
+    }
+    if (get_file_size(raw_pointer) != RAW_SIZE) {
+        fclose(raw_pointer);
+        fprintf(stderr, "Unsupported image type or size\n");
+        return 0;
+    }
+
+    // Read and check colour palette, then pixels, without any decoding
+    uint8_t *palette = malloc(COL_SIZE);
+    uint8_t *image_data = malloc(RAW_SIZE - COL_SIZE);
+    int status = read_palette(palette, raw_pointer);
+    if (status == 1 && pixels_path != NULL && fread(image_data, RAW_SIZE - COL_SIZE, 1, raw_pointer) != 1) {
+        fprintf(stderr, "Could not read image\n");
+        status = 0;
+    }
+    fclose(raw_pointer);
+
+    // Write colour palette and headerless pixels
+    if (status == 1) {
+        scale_palette_down(palette, palette);
+        status = write_image(palette_path, NULL, palette, COL_SIZE) == 1 && (pixels_path == NULL || write_image(pixels_path, NULL, image_data, RAW_SIZE - COL_SIZE) == 1);
+    }
+    free(palette);
+    free(image_data);
+
+    return status;
+}
+
+int merge_palette(const char *pixels_path, const char *palette_path, const char *image_path) {
+    // Open pixels, which may be a .TM image or the headerless pixels of a .RAW image
+    FILE *pixels_pointer = open_unbuffered(pixels_path, "rb");
+    if (pixels_pointer == NULL) {
+        fprintf(stderr, "Error opening image\n");
+        return 0;
+    }
+    const size_t image_size = get_file_size(pixels_pointer);
+    if (image_size != TM_SIZE && image_size != RAW_SIZE - COL_SIZE) {
+        fclose(pixels_pointer);
+        fprintf(stderr, "Unsupported image type or size\n");
+        return 0;
+    }
+
+    // Read pixels and check colour palette
+    uint8_t *palette = malloc(COL_SIZE);
+    uint8_t *image_data = malloc(image_size);
+    int status = fread(image_data, image_size, 1, pixels_pointer) == 1;
+    fclose(pixels_pointer);
+    if (status != 1) {
+        fprintf(stderr, "Could not read image\n");
+    } else {
+        status = read_palette_from_file(palette, palette_path);
+    }
+
+    // Write colour palette followed by pixels, as in a .RAW image
+    if (status == 1) {
+        scale_palette_down(palette, palette);
+        status = write_image(image_path, palette, image_data, image_size);
+    }
+    free(palette);
+    free(image_data);
+
+    return status;
+}
+
+int transform_image(const char *image_path, const transform *t, const char *output_path) {
+    // Open image file
+    FILE *image_pointer = open_unbuffered(image_path, "rb");
+    if (image_pointer == NULL) {
+        fprintf(stderr, "Error opening image\n");
+        return 0;
+    }
+
+    // Get dimensions of the pixels, which follow the colour palette of a .RAW image
+    const size_t file_size = get_file_size(image_pointer);
+    size_t palette_size = 0;
+    int width = 256;
+    int height;
+    switch (file_size) {
+        case TM_SIZE:
+            height = 192;
+            break;
+
+        case RAW_SIZE:
+            palette_size = COL_SIZE;
+            width = 320;
+            height = 200;
+            break;
+
+        case MPH_SIZE:
+            height = 256;
+            break;
+
+        default:
+            fclose(image_pointer);
+            fprintf(stderr, "Unsupported image type or size\n");
+            return 0;
+    }
+
+    // Read whole image, keeping the colour palette as it is
+    uint8_t *source = malloc(file_size);
+    uint8_t *pixels = malloc(file_size - palette_size);
+    int status = fread(source, file_size, 1, image_pointer) == 1;
+    fclose(image_pointer);
+    if (status != 1) {
+        fprintf(stderr, "Could not read image\n");
+    }
+
+    // Transform pixels and write them back in the same format
+    if (status == 1) {
+        status = transform_pixels(pixels, &source[palette_size], width, height, t);
+    }
+    if (status == 1) {
+        status = write_image(output_path, palette_size != 0 ? source : NULL, pixels, file_size - palette_size);
+    }
+    free(source);
+    free(pixels);
+
+    return status;
+}
+
+static int read_ppm_number(FILE *file_pointer) {
+    // Skip whitespace and comments
+    int c = fgetc(file_pointer);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = fgetc(file_pointer);
+            }
+        }
+        c = fgetc(file_pointer);
+    }
+
+    // Read decimal digits
+    int number = -1;
+    while (c >= '0' && c <= '9' && number < 65536) {
+        number = (number < 0 ? 0 : number * 10) + c - '0';
+        c = fgetc(file_pointer);
+    }
+    return number;
+}
+
+// Read a true-colour image into rgb, which has room for the largest game image
+static int read_ppm(const char *ppm_path, uint8_t *rgb, int *width, int *height) {
+    // Open ppm file, buffering its header on the stack
+    char io_buffer[BUFSIZ];
+    FILE *ppm_pointer = fopen(ppm_path, "rb");
+    if (ppm_pointer == NULL) {
+        fprintf(stderr, "Error opening ppm\n");
+        return 0;
+    }
+    setvbuf(ppm_pointer, io_buffer, _IOFBF, sizeof(io_buffer));
+
+    // Read header, which ends with a single whitespace character
+    char magic[2];
+    if (fread(magic, 2, 1, ppm_pointer) != 1 || magic[0] != 'P' || magic[1] != '6') {
+        fclose(ppm_pointer);
+        fprintf(stderr, "Unsupported ppm type\n");
+        return 0;
+    }
+    *width = read_ppm_number(ppm_pointer);
+    *height = read_ppm_number(ppm_pointer);
+    const int max_value = read_ppm_number(ppm_pointer);
+    if (*width <= 0 || *height <= 0 || max_value <= 0 || max_value > 255) {
+        fclose(ppm_pointer);
+        fprintf(stderr, "Unsupported ppm header\n");
+        return 0;
+    }
+
+    // Accept only the sizes of game images, which fit the buffer
+    if (!(*width == 256 && *height == 192) && !(*width == 320 && *height == 200)) {
+        fclose(ppm_pointer);
+        fprintf(stderr, "Unsupported true-colour image size\n");
+        return 0;
+    }
+
+    // Read pixel data
+    const size_t rgb_size = (size_t) *width * *height * 3;
+    if (fread(rgb, rgb_size, 1, ppm_pointer) != 1) {
+        fclose(ppm_pointer);
+        fprintf(stderr, "Could not read ppm\n");
+        return 0;
+    }
+    fclose(ppm_pointer);
+
+    // Scale colour values to 8 bits
+    if (max_value != 255) {
+        for (size_t i = 0; i < rgb_size; i++) {
+            rgb[i] = rgb[i] > max_value ? 255 : rgb[i] * 255 / max_value;
+        }
+    }
+
+    return 1;
+}
+
+static int has_magic(const char *path, const char *magic, const size_t magic_size) {
+    FILE *file_pointer = open_unbuffered(path, "rb");
+    if (file_pointer == NULL) {
+        return 0;
+    }
+    char start[8];
+    const int read_status = fread(start, magic_size, 1, file_pointer);
+    fclose(file_pointer);
+    return read_status == 1 && memcmp(start, magic, magic_size) == 0;
+}
+
+int is_ppm(const char *path) {
+    // Check for binary ppm magic number
+    return has_magic(path, "P6", 2);
+}
+
+int is_gif(const char *path) {
+    // Check for gif signature
+    return has_magic(path, "GIF", 3);
+}
+
+static int probe_gif(const char *gif_path, image_info *info) {
+    // Open gif file without allocating frame or canvas, as no pixels are decoded
+    gd_GIF *gif = gd_open_gif_flags(gif_path, GD_NO_CANVAS | GD_NO_FRAME);
+    if (gif == NULL) {
+        fprintf(stderr, "Error opening gif\n");
+        return 0;
+    }
+    info->type = "GIF";
+    info->width = gif->width;
+    info->height = gif->height;
+    info->colours = gif->gct.size;
+
+    // Walk image descriptors, skipping image data by sub-block lengths
+    int local_palette = 0;
+    int frame_status;
+    while ((frame_status = gd_skip_frame(gif)) == 1) {
+        info->frames++;
+        info->interlaced |= gif->interlace != 0;
+        local_palette |= gif->palette == &gif->lct;
+    }
+    gd_close_gif(gif);
+    if (frame_status != 0) {
+        fprintf(stderr, "Invalid gif block\n");
+        return 0;
+    }
+    info->palette = local_palette ? "global+local" : "global";
+
+    return 1;
+}
+
+static int probe_ppm(FILE *ppm_pointer, image_info *info) {
+    // Read header only
+    fseek(ppm_pointer, 2, SEEK_SET);
+    const int width = read_ppm_number(ppm_pointer);
+    const int height = read_ppm_number(ppm_pointer);
+    const int max_value = read_ppm_number(ppm_pointer);
+    if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF || max_value <= 0 || max_value > 255) {
+        fprintf(stderr, "Unsupported ppm header\n");
+        return 0;
+    }
+    info->type = "PPM";
+    info->width = width;
+    info->height = height;
+    info->palette = "true-colour";
+    info->frames = 1;
+
+    return 1;
+}
+
+int probe_image(const char *path, image_info *info) {
+    memset(info, 0, sizeof(*info));
+
+    // Gifs are probed by their blocks
+    if (is_gif(path)) {
+        return probe_gif(path, info);
+    }
+
+    // Open file
+    FILE *file_pointer = fopen(path, "rb");
+    if (file_pointer == NULL) {
+        fprintf(stderr, "Error opening file\n");
+        return 0;
+    }
+    if (is_ppm(path)) {
+        const int status = probe_ppm(file_pointer, info);
+        fclose(file_pointer);
+        return status;
+    }
+
+    // Get file size to determine game file type
+    const size_t file_size = get_file_size(file_pointer);
+    fclose(file_pointer);
+    info->frames = 1;
+    info->colours = 256;
+    switch (file_size) {
         // .COL colour palette
-        case 256:
-            return gif_to_col(gif, image_path);
+        case COL_SIZE:
+            info->type = "COL";
+            info->width = 16;
+            info->height = 16;
+            info->palette = "self";
+            break;
+
+        // .TM image
+        case TM_SIZE:
+            info->type = "TM";
+            info->width = 256;
+            info->height = 192;
+            info->palette = "external";
+            break;
+
+        // .RAW image
+        case RAW_SIZE:
+            info->type = "RAW";
+            info->width = 320;
+            info->height = 200;
+            info->palette = "embedded";
+            break;
 
         // .MPH heightmap
         case MPH_SIZE:
-            return gif_to_mph(gif, image_path);
+            info->type = "MPH";
+            info->width = 256;
+            info->height = 256;
+            info->palette = "heightmap";
+            break;
+
+        default:
+            fprintf(stderr, "Unsupported file size\n");
+            return 0;
+    }
+
+    return 1;
+}
+
+static uint8_t *read_gif_rgb(const char *gif_path, int *width, int *height) {
+    // Open gif file with its canvas, so transparency and frame offsets are resolved
+    gd_GIF *gif = gd_open_gif(gif_path);
+    if (gif == NULL) {
+        fprintf(stderr, "Error opening gif\n");
+        return NULL;
+    }
+
+    // Check gif frame
+    const int frame_status = gd_get_frame(gif);
+    record_decoder_stats(gif);
+    if (frame_status != 1) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif frame\n");
+        return NULL;
+    }
+
+    // Render first frame as true colour
+    *width = gif->width;
+    *height = gif->height;
+    uint8_t *rgb = malloc((size_t) gif->width * gif->height * 3);
+    if (rgb == NULL) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Could not read gif\n");
+        return NULL;
+    }
+    gd_render_frame(gif, rgb);
+    gd_close_gif(gif);
+
+    return rgb;
+}
+
+uint8_t *load_rgb(const char *image_path, int *width, int *height) {
+    // Gifs are rendered through their own colour palette
+    if (is_gif(image_path)) {
+        return read_gif_rgb(image_path, width, height);
+    }
+
+    // True-colour images are read into a buffer for the largest game image
+    uint8_t *rgb = malloc((RAW_SIZE - COL_SIZE) * 3);
+    if (rgb == NULL) {
+        fprintf(stderr, "Could not read ppm\n");
+        return NULL;
+    }
+    if (read_ppm(image_path, rgb, width, height) != 1) {
+        free(rgb);
+        return NULL;
+    }
+    return rgb;
+}
+
+int rgb_to_image(colour_map *map, const uint8_t *rgb, const int width, const int height, uint8_t *image_data, const char *image_path, dither_mode dither) {
+    // Get image size to determine file type
+    const size_t image_size = (size_t) width * height;
+    int embed_palette;
+    if (width == 256 && height == 192) {
+        embed_palette = 0;
+    } else if (width == 320 && height == 200) {
+        embed_palette = 1;
+    } else {
+        fprintf(stderr, "Unsupported true-colour image size\n");
+        return 0;
+    }
+
+    // Quantise image to colour palette
+    if (quantise_rgb(map, image_data, rgb, width, height, dither) != 1) {
+        fprintf(stderr, "Could not quantise image\n");
+        return 0;
+    }
+
+    // Write image, embedding the 6-bit colour palette in .RAW images
+    return write_image(image_path, embed_palette ? map->palette : NULL, image_data, image_size);
+}
+
+int ppm_to_image(convert_context *context, const char *ppm_path, const char *palette_path, const char *image_path, dither_mode dither) {
+    // Read true-colour image
+    int width, height;
+    if (read_ppm(ppm_path, context->rgb, &width, &height) != 1) {
+        return 0;
+    }
+
+    // Read target colour palette, into the map kept while it is unchanged
+    if (read_palette_from_file(context->palette, palette_path) != 1) {
+        return 0;
+    }
+    colour_map *map = context_colour_map(context, context->palette);
+    if (map == NULL) {
+        fprintf(stderr, "Could not create colour map\n");
+        return 0;
+    }
+
+    // Quantise and write image
+    return rgb_to_image(map, context->rgb, width, height, context->image_data, image_path, dither);
+}
+
+// Grow a caller's output buffer to hold size bytes, keeping it once it is large enough
+static int reserve_output(uint8_t **data, size_t *capacity, const size_t size) {
+    if (size <= *capacity) {
+        return 1;
+    }
+    uint8_t *grown = realloc(*data, size);
+    if (grown == NULL) {
+        fprintf(stderr, "Could not allocate output\n");
+        return 0;
+    }
+    *data = grown;
+    *capacity = size;
+    return 1;
+}
+
+int ppm_to_image_data(convert_context *context, const char *ppm_path, const char *palette_path, dither_mode dither, uint8_t **image_data, size_t *image_capacity, size_t *image_size) {
+    // Read true-colour image and target colour palette
+    int width, height;
+    if (read_ppm(ppm_path, context->rgb, &width, &height) != 1 || read_palette_from_file(context->palette, palette_path) != 1) {
+        return 0;
+    }
+    colour_map *map = context_colour_map(context, context->palette);
+    if (map == NULL) {
+        fprintf(stderr, "Could not create colour map\n");
+        return 0;
+    }
+
+    // Quantise after the 6-bit colour palette of .RAW images
+    const size_t palette_size = width == 320 ? COL_SIZE : 0;
+    *image_size = palette_size + (size_t) width * height;
+    if (reserve_output(image_data, image_capacity, *image_size) != 1) {
+        return 0;
+    }
+    memcpy(*image_data, map->palette, palette_size);
+    if (quantise_rgb(map, *image_data + palette_size, context->rgb, width, height, dither) != 1) {
+        fprintf(stderr, "Could not quantise image\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+// Find the pixels and size of a game image held in memory, filling the colour palette of formats that carry one
+static int view_image_data(const uint8_t *image_data, const size_t image_size, uint8_t *palette, uint8_t *index_data, const uint8_t **pixels, uint16_t *width, uint16_t *height) {
+    *pixels = image_data;
+    switch (image_size) {
+        // .COL colour palette
+        case COL_SIZE:
+            memcpy(palette, image_data, COL_SIZE);
+            for (int i = 0; i < 256; i++) {
+                index_data[i] = i;
+            }
+            *pixels = index_data;
+            *width = 16;
+            *height = 16;
+            break;
+
+        // .TM image, whose colour palette is external
+        case TM_SIZE:
+            *width = 256;
+            *height = 192;
+            return 1;
 
         // .RAW image
-        case RAW_SIZE - COL_SIZE:
-            return gif_to_raw(gif, image_path);
+        case RAW_SIZE:
+            memcpy(palette, image_data, COL_SIZE);
+            *pixels = &image_data[COL_SIZE];
+            *width = 320;
+            *height = 200;
+            break;
+
+        // .MPH heightmap
+        case MPH_SIZE:
+            make_heightmap_palette(palette);
+            *width = 256;
+            *height = 256;
+            return 1;
 
         default:
-            gd_close_gif(gif);
-            fprintf(stderr, "Unsupported gif size\n");
+            fprintf(stderr, "Unsupported image type or size\n");
             return 0;
     }
+
+    return scale_palette_up(palette);
 }
 
-int read_palette(uint8_t *palette, FILE *palette_pointer) {
-    // Read palette file
-    if (fread(palette, COL_SIZE, 1, palette_pointer) != 1) {
-        fprintf(stderr, "Could not read colour palette\n");
+int image_data_to_gif(convert_context *context, const uint8_t *image_data, const size_t image_size, const char *palette_path, const char *gif_path) {
+    // Read pixels in place, such as from a mapped pack entry
+    uint8_t index_data[256];
+    const uint8_t *pixels;
+    uint16_t width, height;
+    if (view_image_data(image_data, image_size, context->palette, index_data, &pixels, &width, &height) != 1) {
+        return 0;
+    }
+    if (image_size == TM_SIZE && palette_path == NULL) {
+        fprintf(stderr, "Image requires a colour palette\n");
+        return 0;
+    }
+    if (image_size == TM_SIZE && read_palette_from_file(context->palette, palette_path) != 1) {
         return 0;
     }
 
-    // Scale palette colour values
-    for(int i = 0; i < COL_SIZE; i++) {
-        // Check colour is valid
-        if(palette[i] >= 64) {
-            fprintf(stderr, "Unsupported colour palette value\n");
+    // Write GIF
+    if (write_gif(context, gif_path, pixels, width, height, context->palette) != 1) {
+        fprintf(stderr, "Could not create gif\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+int image_data_to_gif_data(convert_context *context, const uint8_t *image_data, const size_t image_size, const uint8_t *palette_data, const size_t palette_size, uint8_t **gif_data, size_t *gif_capacity, size_t *gif_size) {
+    // Palettes are given to .TM images only
+    if (palette_data != NULL && (image_size != TM_SIZE || palette_size != COL_SIZE)) {
+        fprintf(stderr, "Unsupported image type or size\n");
+        return 0;
+    }
+
+    // Get image size to determine file type
+    uint8_t palette[COL_SIZE];
+    uint8_t index_data[256];
+    const uint8_t *pixels;
+    uint16_t width, height;
+    if (view_image_data(image_data, image_size, palette, index_data, &pixels, &width, &height) != 1) {
+        return 0;
+    }
+    if (image_size == TM_SIZE) {
+        if (palette_data == NULL) {
+            fprintf(stderr, "Image requires a colour palette\n");
+            return 0;
+        }
+        memcpy(palette, palette_data, COL_SIZE);
+        if (scale_palette_up(palette) != 1) {
             return 0;
         }
+    }
 
-        // Multiply by 4 to scale to 256 colours
-        palette[i] *= 4;
+    // Encode gif into memory held by the arena
+    ge_GIF *gif = ge_new_gif_stream_arena(NULL, width, height, palette, 8, -1, context->encoder);
+    if (gif == NULL) {
+        fprintf(stderr, "Could not create gif\n");
+        return 0;
+    }
+    ge_begin_frame(gif, 0);
+    ge_put_rows(gif, pixels, height);
+    ge_end_frame(gif);
+    record_encoder_stats(gif);
+    const uint8_t *encoded = ge_close_gif_mem(gif, gif_size);
+
+    // Copy it out into the caller's buffer, which outlives the arena's next gif
+    if (encoded == NULL) {
+        fprintf(stderr, "Could not create gif\n");
+        return 0;
+    }
+    if (reserve_output(gif_data, gif_capacity, *gif_size) != 1) {
+        return 0;
     }
+    memcpy(*gif_data, encoded, *gif_size);
 
     return 1;
 }
 
+int gif_data_to_image_data(convert_context *context, const uint8_t *gif_data, const size_t gif_size, const uint8_t *palette_data, const size_t palette_size, uint8_t **image_data, size_t *image_capacity, size_t *image_size) {
+    // Open gif from memory
+    gd_GIF *gif = gd_open_gif_mem_arena(gif_data, gif_size, GD_NO_CANVAS, context->decoder);
+    if (gif == NULL) {
+        fprintf(stderr, "Error opening gif\n");
+        return 0;
+    }
+
+    // Check gif frame and palette
+    const int frame_status = gd_get_frame(gif);
+    record_decoder_stats(gif);
+    if (frame_status != 1) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif frame\n");
+        return 0;
+    }
+    if (gif->palette->size != 256) {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported colour palette size\n");
+        return 0;
+    }
+
+    // Get frame size to determine file type, embedding the gif palette where the type has one
+    const size_t frame_size = gif->width * gif->height;
+    const int embedded = palette_data == NULL;
+    int has_palette;
+    if (!embedded && frame_size == TM_SIZE && palette_size == COL_SIZE) {
+        has_palette = 0;
+    } else if (embedded && frame_size == 256) {
+        if (reserve_output(image_data, image_capacity, COL_SIZE) != 1) {
+            gd_close_gif(gif);
+            return 0;
+        }
+        *image_size = COL_SIZE;
+        scale_palette_down(*image_data, gif->palette->colors);
+        gd_close_gif(gif);
+        return 1;
+    } else if (embedded && frame_size == MPH_SIZE) {
+        has_palette = 0;
+    } else if (embedded && frame_size == RAW_SIZE - COL_SIZE) {
+        has_palette = 1;
+    } else {
+        gd_close_gif(gif);
+        fprintf(stderr, "Unsupported gif size\n");
+        return 0;
+    }
+
+    // Copy frame after the optional palette
+    *image_size = (has_palette ? COL_SIZE : 0) + frame_size;
+    if (reserve_output(image_data, image_capacity, *image_size) != 1) {
+        gd_close_gif(gif);
+        return 0;
+    }
+    uint8_t *pixels = *image_data;
+    if (has_palette) {
+        scale_palette_down(pixels, gif->palette->colors);
+        pixels += COL_SIZE;
+    }
+    memcpy(pixels, gif->frame, frame_size);
+
+    // Remap .TM images to the target palette
+    if (!embedded) {
+        memcpy(context->palette, palette_data, COL_SIZE);
+        colour_map *map = scale_palette_up(context->palette) == 1 ? context_colour_map(context, context->palette) : NULL;
+        if (map == NULL) {
+            gd_close_gif(gif);
+            return 0;
+        }
+        uint8_t remap_table[256];
+        if (!colour_map_remap_table(map, remap_table, gif->palette->colors, gif->palette->size)) {
+            remap_indices(pixels, gif->frame, frame_size, remap_table);
+        }
+    }
+    gd_close_gif(gif);
+
+    return 1;
+}
+
+int read_palette(uint8_t *palette, FILE *palette_pointer) {
+    // Read palette file
+    if (fread(palette, COL_SIZE, 1, palette_pointer) != 1) {
+        fprintf(stderr, "Could not read colour palette\n");
+        return 0;
+    }
+
+    return scale_palette_up(palette);
+}
+
 int read_palette_from_file(uint8_t *palette, const char *palette_path) {
     // Open palette file
-    FILE *palette_pointer = fopen(palette_path, "rb");
+    FILE *palette_pointer = open_unbuffered(palette_path, "rb");
     if (palette_pointer == NULL) {
         fprintf(stderr, "Error opening colour palette\n");
         return 0;
@@ -475,3 +1453,15 @@ int read_palette_from_file(uint8_t *palette, const char *palette_path) {
 
     return 1;
 }
+
+int write_palette_to_file(const char *palette_path, const uint8_t *palette) {
+    // Check colour values are 6-bit, as read_palette would reject anything else
+    for (int i = 0; i < COL_SIZE; i++) {
+        if (palette[i] >= 64) {
+            fprintf(stderr, "Unsupported colour palette value\n");
+            return 0;
+        }
+    }
+
+    return write_image(palette_path, NULL, palette, COL_SIZE);
+}
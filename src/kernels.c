@@ -0,0 +1,243 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "kernels.h"
+
+#include <pthread.h>
+
+// Vector variants need the x86 intrinsics and target attributes of GCC and Clang
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+typedef struct kernel_table {
+    int (*scale_up)(uint8_t *data, size_t size);
+    void (*scale_down)(uint8_t *destination, const uint8_t *source, size_t size);
+    void (*expand)(uint8_t *destination, const uint8_t *source, size_t size, const uint32_t *colours, int channels);
+} kernel_table;
+
+static int scale_up_scalar(uint8_t *data, const size_t size) {
+    // Values of 64 or more have one of the top two bits set, so check them all before scaling any
+    uint8_t bits = 0;
+    for (size_t i = 0; i < size; i++) {
+        bits |= data[i];
+    }
+    if (bits >= 64) {
+        return 0;
+    }
+    for (size_t i = 0; i < size; i++) {
+        data[i] *= 4;
+    }
+    return 1;
+}
+
+static void scale_down_scalar(uint8_t *destination, const uint8_t *source, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        destination[i] = source[i] / 4;
+    }
+}
+
+static void expand_scalar(uint8_t *destination, const uint8_t *source, const size_t size, const uint32_t *colours, const int channels) {
+    if (size == 0) {
+        return;
+    }
+
+    // Store whole words, letting each three-channel store overlap the next pixel
+    const size_t words = channels == 4 ? size : size - 1;
+    for (size_t i = 0; i < words; i++) {
+        memcpy(&destination[i * channels], &colours[source[i]], 4);
+    }
+    if (channels != 4) {
+        memcpy(&destination[words * channels], &colours[source[words]], channels);
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static int scale_up_sse2(uint8_t *data, const size_t size) {
+    // Gather every bit set, then move the 64 bit of each byte up to test it alongside the 128 bit
+    __m128i bits = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        bits = _mm_or_si128(bits, _mm_loadu_si128((const __m128i *) &data[i]));
+    }
+    uint8_t tail_bits = 0;
+    for (; i < size; i++) {
+        tail_bits |= data[i];
+    }
+    if (_mm_movemask_epi8(_mm_or_si128(bits, _mm_add_epi8(bits, bits))) != 0 || tail_bits >= 64) {
+        return 0;
+    }
+
+    // Values are below 64, so shifting 16-bit lanes never carries into the next byte
+    for (i = 0; i + 16 <= size; i += 16) {
+        const __m128i values = _mm_loadu_si128((const __m128i *) &data[i]);
+        _mm_storeu_si128((__m128i *) &data[i], _mm_slli_epi16(values, 2));
+    }
+    for (; i < size; i++) {
+        data[i] *= 4;
+    }
+    return 1;
+}
+
+__attribute__((target("sse2")))
+static void scale_down_sse2(uint8_t *destination, const uint8_t *source, const size_t size) {
+    // Shift 16-bit lanes, then clear the bits shifted in from each neighbouring byte
+    const __m128i mask = _mm_set1_epi8(0x3F);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m128i values = _mm_loadu_si128((const __m128i *) &source[i]);
+        _mm_storeu_si128((__m128i *) &destination[i], _mm_and_si128(_mm_srli_epi16(values, 2), mask));
+    }
+    for (; i < size; i++) {
+        destination[i] = source[i] / 4;
+    }
+}
+
+__attribute__((target("sse2")))
+static void expand_sse2(uint8_t *destination, const uint8_t *source, const size_t size, const uint32_t *colours, const int channels) {
+    // SSE2 cannot compact three-channel pixels, so only four-channel pixels are stored four at a time
+    size_t i = 0;
+    if (channels == 4) {
+        for (; i + 4 <= size; i += 4) {
+            const __m128i pixels = _mm_set_epi32(colours[source[i + 3]], colours[source[i + 2]], colours[source[i + 1]], colours[source[i]]);
+            _mm_storeu_si128((__m128i *) &destination[i * 4], pixels);
+        }
+    }
+    expand_scalar(&destination[i * channels], &source[i], size - i, colours, channels);
+}
+
+__attribute__((target("avx2")))
+static int scale_up_avx2(uint8_t *data, const size_t size) {
+    __m256i bits = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        bits = _mm256_or_si256(bits, _mm256_loadu_si256((const __m256i *) &data[i]));
+    }
+    uint8_t tail_bits = 0;
+    for (; i < size; i++) {
+        tail_bits |= data[i];
+    }
+    if (_mm256_movemask_epi8(_mm256_or_si256(bits, _mm256_add_epi8(bits, bits))) != 0 || tail_bits >= 64) {
+        return 0;
+    }
+    for (i = 0; i + 32 <= size; i += 32) {
+        const __m256i values = _mm256_loadu_si256((const __m256i *) &data[i]);
+        _mm256_storeu_si256((__m256i *) &data[i], _mm256_slli_epi16(values, 2));
+    }
+    for (; i < size; i++) {
+        data[i] *= 4;
+    }
+    return 1;
+}
+
+__attribute__((target("avx2")))
+static void scale_down_avx2(uint8_t *destination, const uint8_t *source, const size_t size) {
+    const __m256i mask = _mm256_set1_epi8(0x3F);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        const __m256i values = _mm256_loadu_si256((const __m256i *) &source[i]);
+        _mm256_storeu_si256((__m256i *) &destination[i], _mm256_and_si256(_mm256_srli_epi16(values, 2), mask));
+    }
+    for (; i < size; i++) {
+        destination[i] = source[i] / 4;
+    }
+}
+
+__attribute__((target("avx2")))
+static void expand_avx2(uint8_t *destination, const uint8_t *source, const size_t size, const uint32_t *colours, const int channels) {
+    // Drop the fourth byte of each pixel within both halves, leaving twelve bytes of pixels at the bottom of each
+    const __m256i compact = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+    );
+    size_t i = 0;
+    if (channels == 4) {
+        for (; i + 8 <= size; i += 8) {
+            const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &source[i]));
+            _mm256_storeu_si256((__m256i *) &destination[i * 4], _mm256_i32gather_epi32((const int *) colours, indices, 4));
+        }
+    } else {
+        // Each half is stored whole, so stop while the second store still ends within the pixels
+        for (; i + 10 <= size; i += 8) {
+            const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) &source[i]));
+            const __m256i pixels = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int *) colours, indices, 4), compact);
+            _mm_storeu_si128((__m128i *) &destination[i * 3], _mm256_castsi256_si128(pixels));
+            _mm_storeu_si128((__m128i *) &destination[i * 3 + 12], _mm256_extracti128_si256(pixels, 1));
+        }
+    }
+    expand_scalar(&destination[i * channels], &source[i], size - i, colours, channels);
+}
+#endif
+
+static const kernel_table tables[] = {
+    {scale_up_scalar, scale_down_scalar, expand_scalar},
+#ifdef HAVE_X86_KERNELS
+    {scale_up_sse2, scale_down_sse2, expand_sse2},
+    {scale_up_avx2, scale_down_avx2, expand_avx2}
+#endif
+};
+
+// Best level the processor supports, and the level in use
+static kernel_level supported_level = KERNEL_SCALAR;
+static kernel_level level = KERNEL_SCALAR;
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+
+static void detect_level(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        supported_level = KERNEL_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        supported_level = KERNEL_SSE2;
+    }
+#endif
+    level = supported_level;
+}
+
+static const kernel_table *get_kernels(void) {
+    pthread_once(&detect_once, detect_level);
+    return &tables[level];
+}
+
+kernel_level kernels_level(void) {
+    pthread_once(&detect_once, detect_level);
+    return level;
+}
+
+// Force a lower level, such as for comparing variants, before any conversions start
+int kernels_set_level(const kernel_level new_level) {
+    pthread_once(&detect_once, detect_level);
+    if (new_level > supported_level) {
+        return 0;
+    }
+    level = new_level;
+    return 1;
+}
+
+const char *kernels_name(const kernel_level kernel) {
+    switch (kernel) {
+        case KERNEL_SSE2:
+            return "SSE2";
+        case KERNEL_AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+int kernel_scale_up(uint8_t *data, const size_t size) {
+    return get_kernels()->scale_up(data, size);
+}
+
+void kernel_scale_down(uint8_t *destination, const uint8_t *source, const size_t size) {
+    get_kernels()->scale_down(destination, source, size);
+}
+
+void kernel_expand(uint8_t *destination, const uint8_t *source, const size_t size, const uint32_t *colours, const int channels) {
+    get_kernels()->expand(destination, source, size, colours, channels);
+}
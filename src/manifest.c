@@ -0,0 +1,87 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "manifest.h"
+
+// Set compile-time constants
+#define LINE_SIZE 4096
+
+static char *copy_field(const char *start, size_t length) {
+    char *field = malloc(length + 1);
+    memcpy(field, start, length);
+    field[length] = '\0';
+    return field;
+}
+
+static int parse_line(manifest_entry *entry, char *line) {
+    // Strip line ending
+    line[strcspn(line, "\r\n")] = '\0';
+
+    // Split source, palette and destination fields
+    char *first = strchr(line, ',');
+    if (first == NULL) {
+        return 0;
+    }
+    char *second = strchr(first + 1, ',');
+    if (second == NULL || strchr(second + 1, ',') != NULL || first == line || second[1] == '\0') {
+        return 0;
+    }
+    entry->source = copy_field(line, first - line);
+    entry->palette = second > first + 1 ? copy_field(first + 1, second - first - 1) : NULL;
+    entry->destination = copy_field(second + 1, strlen(second + 1));
+
+    return 1;
+}
+
+manifest *manifest_read(const char *manifest_path) {
+    // Open manifest file
+    FILE *manifest_pointer = fopen(manifest_path, "r");
+    if (manifest_pointer == NULL) {
+        fprintf(stderr, "Error opening manifest\n");
+        return NULL;
+    }
+
+    // Read one source,palette,destination entry per line
+    manifest *list = calloc(1, sizeof(*list));
+    int capacity = 0;
+    int line_number = 0;
+    char line[LINE_SIZE];
+    while (fgets(line, LINE_SIZE, manifest_pointer) != NULL) {
+        line_number++;
+
+        // Skip blank lines and comments
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#') {
+            continue;
+        }
+
+        // Grow entry list
+        if (list->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            list->entries = realloc(list->entries, capacity * sizeof(manifest_entry));
+        }
+
+        if (parse_line(&list->entries[list->count], line) != 1) {
+            fclose(manifest_pointer);
+            manifest_free(list);
+            fprintf(stderr, "Invalid manifest line %d\n", line_number);
+            return NULL;
+        }
+        list->count++;
+    }
+    fclose(manifest_pointer);
+
+    return list;
+}
+
+void manifest_free(manifest *list) {
+    for (int i = 0; i < list->count; i++) {
+        free(list->entries[i].source);
+        free(list->entries[i].palette);
+        free(list->entries[i].destination);
+    }
+    free(list->entries);
+    free(list);
+}
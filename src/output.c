@@ -0,0 +1,323 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+// Expose syncfs and fdatasync
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "output.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#endif
+
+// Folders of outputs renamed into place since their folders were last synced
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char pending[OUTPUT_GROUP_SIZE][FILENAME_MAX];
+static int pending_count = 0;
+static int pending_outputs = 0;
+static unsigned long temp_count = 0;
+
+// Outputs committed inside a group, still waiting under their temporary names
+static char staged_temp_paths[OUTPUT_GROUP_SIZE][FILENAME_MAX];
+static char staged_paths[OUTPUT_GROUP_SIZE][FILENAME_MAX];
+static int staged_count = 0;
+static int grouping = 0;
+
+void output_temp_path(char *temp_path, size_t temp_size, const char *path) {
+    // Name each temporary file uniquely, so outputs sharing a destination never write to the same one
+    pthread_mutex_lock(&pending_mutex);
+    const unsigned long count = temp_count++;
+    pthread_mutex_unlock(&pending_mutex);
+    snprintf(temp_path, temp_size, "%s.%ld.%lu.tmp", path, (long) getpid(), count);
+}
+
+static void get_folder(char *folder, size_t folder_size, const char *path) {
+    // Copy everything before the last separator, or the current folder
+    const char *separator = strrchr(path, '/');
+#ifdef _WIN32
+    const char *backslash = strrchr(path, '\\');
+    separator = backslash > separator ? backslash : separator;
+#endif
+    if (separator == NULL) {
+        snprintf(folder, folder_size, ".");
+        return;
+    }
+    const size_t length = separator == path ? 1 : (size_t) (separator - path);
+    snprintf(folder, folder_size, "%.*s", (int) length, path);
+}
+
+// Write back a file's data, so it reaches the disk before its name does
+static int sync_file(const char *path) {
+#ifdef _WIN32
+    (void) path;
+    return 1;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+#ifdef __linux__
+    int sync_status = fdatasync(fd) == 0;
+#else
+    int sync_status = fsync(fd) == 0;
+#endif
+    if (close(fd) != 0) {
+        sync_status = 0;
+    }
+    return sync_status;
+#endif
+}
+
+// Write back the data of a group of files with as few syncs as possible
+static int sync_files(char *const *paths, int count) {
+    int sync_status = 1;
+#if defined(__linux__)
+    // One syncfs per file system writes back every file's data
+    dev_t devices[OUTPUT_GROUP_SIZE];
+    int device_count = 0;
+    for (int i = 0; i < count; i++) {
+        const int fd = open(paths[i], O_RDONLY);
+        struct stat file_stat;
+        if (fd == -1 || fstat(fd, &file_stat) != 0) {
+            if (fd != -1) {
+                close(fd);
+            }
+            sync_status = 0;
+            continue;
+        }
+        int seen = 0;
+        for (int j = 0; j < device_count && !seen; j++) {
+            seen = devices[j] == file_stat.st_dev;
+        }
+        if (!seen && device_count < OUTPUT_GROUP_SIZE) {
+            devices[device_count++] = file_stat.st_dev;
+            if (syncfs(fd) != 0) {
+                sync_status = 0;
+            }
+        }
+        close(fd);
+    }
+#elif !defined(_WIN32)
+    // Without syncfs, a single sync covers every file system
+    (void) paths;
+    if (count > 0) {
+        sync();
+    }
+#else
+    (void) paths;
+    (void) count;
+#endif
+    return sync_status;
+}
+
+// Flush pending folders, with the mutex held
+static int sync_pending(void) {
+    int sync_status = 1;
+    for (int i = 0; i < pending_count; i++) {
+#ifndef _WIN32
+        // Write back the folder entries of the renamed outputs
+        const int fd = open(pending[i], O_RDONLY);
+        if (fd == -1 || fsync(fd) != 0) {
+            sync_status = 0;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+#endif
+    }
+    pending_count = 0;
+    pending_outputs = 0;
+
+    return sync_status;
+}
+
+// Remember the folder of a renamed output, with the mutex held
+static int add_pending(const char *path) {
+    char folder[FILENAME_MAX];
+    get_folder(folder, sizeof(folder), path);
+    int found = 0;
+    for (int i = 0; i < pending_count && !found; i++) {
+        found = strcmp(pending[i], folder) == 0;
+    }
+    if (!found) {
+        memcpy(pending[pending_count++], folder, sizeof(folder));
+    }
+
+    // Sync folders once a group of outputs is pending
+    if (++pending_outputs == OUTPUT_GROUP_SIZE || pending_count == OUTPUT_GROUP_SIZE) {
+        return sync_pending();
+    }
+    return 1;
+}
+
+// Rename a synced temporary file into place, with the mutex held
+static int rename_locked(const char *temp_path, const char *path) {
+#ifdef _WIN32
+    // Windows cannot rename over an existing file
+    remove(path);
+#endif
+    if (rename(temp_path, path) != 0) {
+        remove(temp_path);
+        fprintf(stderr, "Error renaming %s into place\n", path);
+        return 0;
+    }
+    if (add_pending(path) != 1) {
+        fprintf(stderr, "Error syncing outputs\n");
+        return 0;
+    }
+    return 1;
+}
+
+// Rename a synced temporary file into place and remember its folder
+static int rename_output(const char *temp_path, const char *path) {
+    pthread_mutex_lock(&pending_mutex);
+    const int rename_status = rename_locked(temp_path, path);
+    pthread_mutex_unlock(&pending_mutex);
+    return rename_status;
+}
+
+// Sync staged outputs' data once, then rename them into place and sync their folders, with the mutex held
+static int commit_staged(void) {
+    char *temp_paths[OUTPUT_GROUP_SIZE];
+    for (int i = 0; i < staged_count; i++) {
+        temp_paths[i] = staged_temp_paths[i];
+    }
+    int commit_status = 1;
+    if (sync_files(temp_paths, staged_count) != 1) {
+        for (int i = 0; i < staged_count; i++) {
+            remove(temp_paths[i]);
+        }
+        fprintf(stderr, "Error syncing outputs\n");
+        commit_status = 0;
+    } else {
+        for (int i = 0; i < staged_count; i++) {
+            if (rename_locked(temp_paths[i], staged_paths[i]) != 1) {
+                commit_status = 0;
+            }
+        }
+    }
+    staged_count = 0;
+    if (sync_pending() != 1) {
+        fprintf(stderr, "Error syncing outputs\n");
+        commit_status = 0;
+    }
+    return commit_status;
+}
+
+// Queue an output for the group's commit, with the mutex held
+static int stage_output(const char *temp_path, const char *path) {
+    if (strlen(temp_path) >= FILENAME_MAX || strlen(path) >= FILENAME_MAX) {
+        remove(temp_path);
+        fprintf(stderr, "Output path too long %s\n", path);
+        return 0;
+    }
+
+    // A later output to the same destination replaces the earlier one, as its rename would
+    int index = 0;
+    while (index < staged_count && strcmp(staged_paths[index], path) != 0) {
+        index++;
+    }
+    if (index < staged_count) {
+        remove(staged_temp_paths[index]);
+    } else {
+        staged_count++;
+        strcpy(staged_paths[index], path);
+    }
+    strcpy(staged_temp_paths[index], temp_path);
+
+    // Commit once a whole group is staged
+    if (staged_count == OUTPUT_GROUP_SIZE) {
+        return commit_staged();
+    }
+    return 1;
+}
+
+int output_commit(const char *temp_path, const char *path) {
+    // Inside a group, leave syncing and renaming to the group's commit
+    pthread_mutex_lock(&pending_mutex);
+    if (grouping) {
+        const int stage_status = stage_output(temp_path, path);
+        pthread_mutex_unlock(&pending_mutex);
+        return stage_status;
+    }
+    pthread_mutex_unlock(&pending_mutex);
+
+    if (sync_file(temp_path) != 1) {
+        remove(temp_path);
+        fprintf(stderr, "Error syncing %s\n", path);
+        return 0;
+    }
+    return rename_output(temp_path, path);
+}
+
+int output_commit_group(char *const *temp_paths, const char *const *paths, int count, int *results) {
+    // Sync the whole group's data once, then rename it into place and sync its folders
+    if (sync_files(temp_paths, count) != 1) {
+        for (int i = 0; i < count; i++) {
+            remove(temp_paths[i]);
+            results[i] = 0;
+        }
+        fprintf(stderr, "Error syncing outputs\n");
+        return 0;
+    }
+    int commit_status = 1;
+    for (int i = 0; i < count; i++) {
+        results[i] = rename_output(temp_paths[i], paths[i]);
+        if (results[i] != 1) {
+            commit_status = 0;
+        }
+    }
+    if (output_sync() != 1) {
+        commit_status = 0;
+    }
+    return commit_status;
+}
+
+void output_abort(const char *temp_path) {
+    remove(temp_path);
+}
+
+void output_staged_path(char *current_path, size_t current_size, const char *path) {
+    // Outputs waiting in a group still live under their temporary names
+    pthread_mutex_lock(&pending_mutex);
+    int index = 0;
+    while (index < staged_count && strcmp(staged_paths[index], path) != 0) {
+        index++;
+    }
+    snprintf(current_path, current_size, "%s", index < staged_count ? staged_temp_paths[index] : path);
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+void output_begin_group(void) {
+    pthread_mutex_lock(&pending_mutex);
+    grouping = 1;
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+int output_end_group(void) {
+    pthread_mutex_lock(&pending_mutex);
+    grouping = 0;
+    pthread_mutex_unlock(&pending_mutex);
+    return output_sync();
+}
+
+int output_sync(void) {
+    // Commit staged outputs, then sync the folders of everything renamed
+    pthread_mutex_lock(&pending_mutex);
+    int sync_status = commit_staged();
+    pthread_mutex_unlock(&pending_mutex);
+    return sync_status;
+}
@@ -0,0 +1,321 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "pack.h"
+#include "image.h"
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+// Set compile-time constants
+#define PACK_MAGIC "RIPK"
+#define PACK_VERSION 1
+#define HEADER_SIZE 24
+#define ENTRY_SIZE 72
+
+static void put_u32(uint8_t *bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = value >> (i * 8);
+    }
+}
+
+static void put_u64(uint8_t *bytes, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = value >> (i * 8);
+    }
+}
+
+static uint32_t get_u32(const uint8_t *bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t) bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+static uint64_t get_u64(const uint8_t *bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t) bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+static pack_type detect_type(const uint8_t *start, size_t start_size, uint64_t length) {
+    if (start_size >= 3 && memcmp(start, "GIF", 3) == 0) {
+        return PACK_GIF;
+    }
+    switch (length) {
+        case COL_SIZE:
+            return PACK_COL;
+        case TM_SIZE:
+            return PACK_TM;
+        case RAW_SIZE:
+            return PACK_RAW;
+        case MPH_SIZE:
+            return PACK_MPH;
+        default:
+            return PACK_OTHER;
+    }
+}
+
+const char *pack_type_name(pack_type type) {
+    static const char *names[] = {"other", "gif", "col", "tm", "raw", "mph"};
+    return names[type];
+}
+
+pack_writer *pack_create(const char *pack_path) {
+    // Open temporary pack file, renamed into place once complete
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), pack_path);
+    FILE *file_pointer = fopen(temp_path, "wb");
+    if (file_pointer == NULL) {
+        fprintf(stderr, "Error creating pack file\n");
+        return NULL;
+    }
+
+    // Reserve header, which is written once the index is known
+    const uint8_t header[HEADER_SIZE] = {0};
+    if (fwrite(header, HEADER_SIZE, 1, file_pointer) != 1) {
+        fclose(file_pointer);
+        output_abort(temp_path);
+        fprintf(stderr, "Error writing pack file\n");
+        return NULL;
+    }
+
+    pack_writer *writer = calloc(1, sizeof(*writer));
+    writer->path = malloc(strlen(pack_path) + 1);
+    strcpy(writer->path, pack_path);
+    writer->temp_path = malloc(strlen(temp_path) + 1);
+    strcpy(writer->temp_path, temp_path);
+    writer->file_pointer = file_pointer;
+    writer->offset = HEADER_SIZE;
+    return writer;
+}
+
+// Check an entry name fits in the index
+static int check_name(const char *name) {
+    if (strlen(name) > PACK_NAME_SIZE || name[0] == '\0') {
+        fprintf(stderr, "Unsupported pack entry name %s\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+// Record an entry just appended to the pack, typed by its first bytes and length
+static void add_entry(pack_writer *writer, const char *name, const uint8_t *start, size_t start_size, uint64_t length) {
+    // Grow index
+    if (writer->count == writer->capacity) {
+        writer->capacity = writer->capacity ? writer->capacity * 2 : 64;
+        writer->entries = realloc(writer->entries, writer->capacity * sizeof(pack_entry));
+    }
+
+    // Record entry
+    pack_entry *entry = &writer->entries[writer->count++];
+    memset(entry->name, 0, sizeof(entry->name));
+    strcpy(entry->name, name);
+    entry->type = detect_type(start, start_size, length);
+    entry->offset = writer->offset;
+    entry->length = length;
+    writer->offset += length;
+}
+
+int pack_add_data(pack_writer *writer, const char *name, const uint8_t *data, size_t size) {
+    if (check_name(name) != 1) {
+        return 0;
+    }
+
+    // Append bytes already in memory
+    if (size > 0 && fwrite(data, size, 1, writer->file_pointer) != 1) {
+        fprintf(stderr, "Error writing pack file\n");
+        return 0;
+    }
+
+    add_entry(writer, name, data, size < 3 ? size : 3, size);
+    return 1;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const pack_entry *) a)->name, ((const pack_entry *) b)->name);
+}
+
+int pack_close(pack_writer *writer) {
+    // Sort index by name for binary search
+    qsort(writer->entries, writer->count, sizeof(pack_entry), compare_entries);
+    int write_status = 1;
+    for (int i = 1; i < writer->count; i++) {
+        if (strcmp(writer->entries[i - 1].name, writer->entries[i].name) == 0) {
+            fprintf(stderr, "Duplicate pack entry name %s\n", writer->entries[i].name);
+            write_status = 0;
+        }
+    }
+
+    // Write index
+    uint8_t record[ENTRY_SIZE];
+    for (int i = 0; i < writer->count && write_status == 1; i++) {
+        const pack_entry *entry = &writer->entries[i];
+        memset(record, 0, ENTRY_SIZE);
+        memcpy(record, entry->name, PACK_NAME_SIZE + 1);
+        put_u32(&record[48], entry->type);
+        put_u64(&record[56], entry->offset);
+        put_u64(&record[64], entry->length);
+        write_status = fwrite(record, ENTRY_SIZE, 1, writer->file_pointer) == 1;
+    }
+
+    // Write header
+    uint8_t header[HEADER_SIZE] = {0};
+    memcpy(header, PACK_MAGIC, 4);
+    put_u32(&header[4], PACK_VERSION);
+    put_u32(&header[8], writer->count);
+    put_u64(&header[16], writer->offset);
+    if (write_status == 1) {
+        write_status = fseek(writer->file_pointer, 0, SEEK_SET) == 0 && fwrite(header, HEADER_SIZE, 1, writer->file_pointer) == 1;
+    }
+    if (fclose(writer->file_pointer) != 0) {
+        write_status = 0;
+    }
+
+    // Rename complete pack into place
+    if (write_status == 1) {
+        write_status = output_commit(writer->temp_path, writer->path);
+    } else {
+        output_abort(writer->temp_path);
+        fprintf(stderr, "Error writing pack file\n");
+    }
+    free(writer->path);
+    free(writer->temp_path);
+    free(writer->entries);
+    free(writer);
+
+    return write_status;
+}
+
+pack_reader *pack_open(const char *pack_path) {
+    // Open pack file
+    const int fd = open(pack_path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Error opening pack file\n");
+        return NULL;
+    }
+#ifdef _WIN32
+    setmode(fd, O_BINARY);
+#endif
+    const off_t size = lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+    if (size < HEADER_SIZE) {
+        close(fd);
+        fprintf(stderr, "Unsupported pack file\n");
+        return NULL;
+    }
+
+    // Map pack into memory, or read it where mapping is unavailable
+#ifdef _WIN32
+    uint8_t *data = malloc(size);
+    if (data != NULL && read(fd, data, size) != size) {
+        free(data);
+        data = NULL;
+    }
+#else
+    uint8_t *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        data = NULL;
+    }
+#endif
+    close(fd);
+    if (data == NULL) {
+        fprintf(stderr, "Error reading pack file\n");
+        return NULL;
+    }
+
+    pack_reader *reader = calloc(1, sizeof(*reader));
+    reader->data = data;
+    reader->size = size;
+
+    // Check header and index bounds
+    const uint64_t index_offset = get_u64(&data[16]);
+    reader->count = get_u32(&data[8]);
+    if (memcmp(data, PACK_MAGIC, 4) != 0 || get_u32(&data[4]) != PACK_VERSION || index_offset > reader->size || (reader->size - index_offset) / ENTRY_SIZE < reader->count) {
+        pack_close_reader(reader);
+        fprintf(stderr, "Unsupported pack file\n");
+        return NULL;
+    }
+    reader->index = &data[index_offset];
+
+    return reader;
+}
+
+int pack_get(const pack_reader *reader, uint32_t i, pack_entry *entry) {
+    if (i >= reader->count) {
+        return 0;
+    }
+
+    // Decode index record, checking its data lies within the pack
+    const uint8_t *record = &reader->index[(size_t) i * ENTRY_SIZE];
+    memcpy(entry->name, record, PACK_NAME_SIZE);
+    entry->name[PACK_NAME_SIZE] = '\0';
+    entry->type = get_u32(&record[48]);
+    entry->offset = get_u64(&record[56]);
+    entry->length = get_u64(&record[64]);
+    if (entry->type > PACK_MPH || entry->offset > reader->size || entry->length > reader->size - entry->offset) {
+        return 0;
+    }
+
+    return 1;
+}
+
+static int find_entry(const pack_reader *reader, const char *name, pack_entry *entry) {
+    // Binary search sorted index
+    uint32_t low = 0;
+    uint32_t high = reader->count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const int order = strncmp(name, (const char *) &reader->index[(size_t) middle * ENTRY_SIZE], PACK_NAME_SIZE + 1);
+        if (order == 0) {
+            return pack_get(reader, middle, entry);
+        }
+        if (order < 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    return 0;
+}
+
+int pack_find(const pack_reader *reader, const char *name, pack_view *view) {
+    pack_entry entry;
+    if (find_entry(reader, name, &entry) != 1) {
+        return 0;
+    }
+    view->data = &reader->data[entry.offset];
+    view->size = entry.length;
+    view->type = entry.type;
+    return 1;
+}
+
+gd_GIF *pack_open_gif(const pack_reader *reader, const char *name, int flags) {
+    pack_view view;
+    if (pack_find(reader, name, &view) != 1 || view.type != PACK_GIF) {
+        return NULL;
+    }
+
+    // Decode straight from the mapped entry, which must stay mapped until the gif is closed
+    return gd_open_gif_mem(view.data, view.size, flags);
+}
+
+void pack_close_reader(pack_reader *reader) {
+#ifdef _WIN32
+    free((uint8_t *) reader->data);
+#else
+    munmap((uint8_t *) reader->data, reader->size);
+#endif
+    free(reader);
+}
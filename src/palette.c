@@ -0,0 +1,541 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "palette.h"
+#include "image.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <math.h>
+
+// Set compile-time constants
+#define COLOUR_COUNT (64 * 64 * 64)
+#define KMEANS_ITERATIONS 32
+#define MIN_KMEANS_TASK 4096
+#define MAX_WORKERS 64
+
+// Distinct 6-bit colour and the number of pixels holding it
+typedef struct colour_entry {
+    uint8_t red, green, blue;
+    uint8_t cluster;
+    uint64_t weight;
+} colour_entry;
+
+// Range of colour entries split by median cut
+typedef struct colour_box {
+    int start, end;
+    int axis;
+    uint64_t priority;
+} colour_box;
+
+typedef struct cluster_sum {
+    uint64_t red, green, blue, weight;
+} cluster_sum;
+
+typedef struct histogram_task {
+    const char **image_paths;
+    int count, first, step;
+    uint64_t *histogram;
+    int status;
+} histogram_task;
+
+typedef struct kmeans_task {
+    colour_entry *entries;
+    int start, end;
+    const float *centroids;
+    const float *spacing; // Distance between every pair of centroids
+    const uint8_t *neighbours; // Other centroids of each centroid, nearest first
+    int cluster_count;
+    cluster_sum sums[256];
+    int changes;
+} kmeans_task;
+
+typedef struct remap_task {
+    const char **image_paths;
+    int count, first, step;
+    const uint8_t *palette;
+    const char *output_dir;
+    dither_mode dither;
+    int status;
+} remap_task;
+
+// Output a remapped image is written to
+typedef struct remap_output {
+    char path[FILENAME_MAX];
+    const char *image_path;
+} remap_output;
+
+static int clamp_workers(int workers, int jobs) {
+    if (workers > jobs) {
+        workers = jobs;
+    }
+    if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+    return workers < 1 ? 1 : workers;
+}
+
+// Run one thread per task and wait for them all, failing if any thread cannot start
+static int run_tasks(void *(*worker)(void *), void *tasks, size_t task_size, int count) {
+    pthread_t threads[MAX_WORKERS];
+    int started = 0;
+    while (started < count && pthread_create(&threads[started], NULL, worker, (uint8_t *) tasks + started * task_size) == 0) {
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (started < count) {
+        fprintf(stderr, "Error starting palette threads\n");
+        return 0;
+    }
+    return 1;
+}
+
+static void *histogram_worker(void *argument) {
+    histogram_task *task = argument;
+    trace_name_thread("reader");
+    for (int i = task->first; i < task->count; i += task->step) {
+        const uint64_t read_start = trace_begin();
+        int width, height;
+        uint8_t *rgb = load_rgb(task->image_paths[i], &width, &height);
+        if (rgb == NULL) {
+            fprintf(stderr, "Could not read %s\n", task->image_paths[i]);
+            task->status = 0;
+            trace_end("read", task->image_paths[i], read_start);
+            continue;
+        }
+
+        // Count colours at the 6-bit precision of the palette
+        const size_t size = (size_t) width * height;
+        for (size_t j = 0; j < size; j++) {
+            const uint8_t *pixel = &rgb[j * 3];
+            task->histogram[((pixel[0] >> 2) << 12) | ((pixel[1] >> 2) << 6) | (pixel[2] >> 2)]++;
+        }
+        free(rgb);
+        trace_end("read", task->image_paths[i], read_start);
+    }
+    return NULL;
+}
+
+// Sort key with the given axis most significant, so every ordering is total
+static uint32_t get_axis_key(const colour_entry *entry, int axis) {
+    const uint32_t channels[3] = {entry->red, entry->green, entry->blue};
+    return channels[axis] << 12 | channels[(axis + 1) % 3] << 6 | channels[(axis + 2) % 3];
+}
+
+static int compare_red(const void *a, const void *b) {
+    return (int) get_axis_key(a, 0) - (int) get_axis_key(b, 0);
+}
+
+static int compare_green(const void *a, const void *b) {
+    return (int) get_axis_key(a, 1) - (int) get_axis_key(b, 1);
+}
+
+static int compare_blue(const void *a, const void *b) {
+    return (int) get_axis_key(a, 2) - (int) get_axis_key(b, 2);
+}
+
+static void measure_box(const colour_entry *entries, colour_box *box) {
+    // Find the widest channel, weighting its range by the pixels in the box
+    uint8_t low[3] = {63, 63, 63}, high[3] = {0, 0, 0};
+    uint64_t weight = 0;
+    for (int i = box->start; i < box->end; i++) {
+        const uint8_t channels[3] = {entries[i].red, entries[i].green, entries[i].blue};
+        for (int c = 0; c < 3; c++) {
+            low[c] = channels[c] < low[c] ? channels[c] : low[c];
+            high[c] = channels[c] > high[c] ? channels[c] : high[c];
+        }
+        weight += entries[i].weight;
+    }
+    box->axis = 0;
+    for (int c = 1; c < 3; c++) {
+        if (high[c] - low[c] > high[box->axis] - low[box->axis]) {
+            box->axis = c;
+        }
+    }
+    box->priority = box->end - box->start > 1 ? weight * (high[box->axis] - low[box->axis]) : 0;
+}
+
+static int median_cut(colour_entry *entries, int entry_count, colour_box *boxes) {
+    static int (*const comparers[3])(const void *, const void *) = {compare_red, compare_green, compare_blue};
+    int box_count = 1;
+    boxes[0].start = 0;
+    boxes[0].end = entry_count;
+    measure_box(entries, &boxes[0]);
+    while (box_count < 256) {
+        // Split the box with the most weighted spread
+        colour_box *box = &boxes[0];
+        for (int i = 1; i < box_count; i++) {
+            if (boxes[i].priority > box->priority) {
+                box = &boxes[i];
+            }
+        }
+        if (box->priority == 0) {
+            break;
+        }
+
+        // Split at the weighted median of its widest channel, keeping both halves non-empty
+        qsort(&entries[box->start], box->end - box->start, sizeof(colour_entry), comparers[box->axis]);
+        uint64_t total = 0, half = 0;
+        for (int i = box->start; i < box->end; i++) {
+            total += entries[i].weight;
+        }
+        int split = box->start + 1;
+        for (int i = box->start; i < box->end - 1; i++) {
+            half += entries[i].weight;
+            split = i + 1;
+            if (half * 2 >= total) {
+                break;
+            }
+        }
+        colour_box *upper = &boxes[box_count++];
+        upper->start = split;
+        upper->end = box->end;
+        box->end = split;
+        measure_box(entries, box);
+        measure_box(entries, upper);
+    }
+    return box_count;
+}
+
+static float get_distance(const float *centroid, const colour_entry *entry) {
+    const float red_delta = centroid[0] - entry->red;
+    const float green_delta = centroid[1] - entry->green;
+    const float blue_delta = centroid[2] - entry->blue;
+    return red_delta * red_delta + green_delta * green_delta + blue_delta * blue_delta;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    const uint64_t first = *(const uint64_t *) a, second = *(const uint64_t *) b;
+    return first < second ? -1 : first > second;
+}
+
+static void sort_neighbours(const float *centroids, int cluster_count, float *spacing, uint8_t *neighbours) {
+    uint64_t keys[256];
+    for (int j = 0; j < cluster_count; j++) {
+        for (int k = 0; k < cluster_count; k++) {
+            const float red_delta = centroids[j * 3] - centroids[k * 3];
+            const float green_delta = centroids[j * 3 + 1] - centroids[k * 3 + 1];
+            const float blue_delta = centroids[j * 3 + 2] - centroids[k * 3 + 2];
+            spacing[j * 256 + k] = sqrtf(red_delta * red_delta + green_delta * green_delta + blue_delta * blue_delta);
+
+            // Non-negative floats order like their bits, so each key sorts by distance then index
+            uint32_t bits;
+            memcpy(&bits, &spacing[j * 256 + k], 4);
+            keys[k] = (uint64_t) bits << 8 | k;
+        }
+        qsort(keys, cluster_count, sizeof(uint64_t), compare_keys);
+        for (int k = 0; k < cluster_count; k++) {
+            neighbours[j * 256 + k] = keys[k] & 0xFF;
+        }
+    }
+}
+
+static void *kmeans_worker(void *argument) {
+    kmeans_task *task = argument;
+    memset(task->sums, 0, sizeof(task->sums));
+    task->changes = 0;
+    for (int i = task->start; i < task->end; i++) {
+        // Search outwards from the colour's current centroid for the nearest one
+        colour_entry *entry = &task->entries[i];
+        const int current = entry->cluster;
+        const float current_root = sqrtf(get_distance(&task->centroids[current * 3], entry));
+        int nearest = current;
+        float nearest_distance = current_root * current_root;
+        float limit = current_root * 2;
+        for (int k = 1; k < task->cluster_count; k++) {
+            // Centroids further from the current one than the limit are further from the colour than the nearest
+            const int j = task->neighbours[current * 256 + k];
+            if (task->spacing[current * 256 + j] >= limit) {
+                break;
+            }
+            const float distance = get_distance(&task->centroids[j * 3], entry);
+            if (distance < nearest_distance) {
+                nearest = j;
+                nearest_distance = distance;
+                limit = current_root + sqrtf(distance);
+            }
+        }
+        task->changes += entry->cluster != nearest;
+        entry->cluster = nearest;
+
+        // Accumulate weighted channel sums for the next centroids
+        cluster_sum *sum = &task->sums[nearest];
+        sum->red += entry->red * entry->weight;
+        sum->green += entry->green * entry->weight;
+        sum->blue += entry->blue * entry->weight;
+        sum->weight += entry->weight;
+    }
+    return NULL;
+}
+
+static int kmeans(colour_entry *entries, int entry_count, float *centroids, int cluster_count, int workers) {
+    // Split colours evenly between threads, giving each enough to be worth starting
+    const int task_count = clamp_workers(workers, entry_count / MIN_KMEANS_TASK);
+    kmeans_task *tasks = malloc(task_count * sizeof(kmeans_task));
+    for (int i = 0; i < task_count; i++) {
+        tasks[i].entries = entries;
+        tasks[i].start = (int) ((int64_t) entry_count * i / task_count);
+        tasks[i].end = (int) ((int64_t) entry_count * (i + 1) / task_count);
+        tasks[i].centroids = centroids;
+        tasks[i].cluster_count = cluster_count;
+    }
+
+    float *spacing = malloc(256 * 256 * sizeof(float));
+    uint8_t *neighbours = malloc(256 * 256);
+    for (int i = 0; i < task_count; i++) {
+        tasks[i].spacing = spacing;
+        tasks[i].neighbours = neighbours;
+    }
+    int status = 1;
+    for (int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+        const uint64_t cluster_start = trace_begin();
+        sort_neighbours(centroids, cluster_count, spacing, neighbours);
+        if (run_tasks(kmeans_worker, tasks, sizeof(kmeans_task), task_count) != 1) {
+            trace_end("cluster", NULL, cluster_start);
+            status = 0;
+            break;
+        }
+
+        // Move each centroid to the mean of its colours, leaving empty clusters in place
+        int changes = 0;
+        for (int j = 0; j < cluster_count; j++) {
+            cluster_sum total = {0, 0, 0, 0};
+            for (int i = 0; i < task_count; i++) {
+                total.red += tasks[i].sums[j].red;
+                total.green += tasks[i].sums[j].green;
+                total.blue += tasks[i].sums[j].blue;
+                total.weight += tasks[i].sums[j].weight;
+            }
+            if (total.weight > 0) {
+                centroids[j * 3] = (float) total.red / total.weight;
+                centroids[j * 3 + 1] = (float) total.green / total.weight;
+                centroids[j * 3 + 2] = (float) total.blue / total.weight;
+            }
+        }
+        for (int i = 0; i < task_count; i++) {
+            changes += tasks[i].changes;
+        }
+        trace_end("cluster", NULL, cluster_start);
+
+        // Stop once no colour changes cluster
+        if (changes == 0) {
+            break;
+        }
+    }
+    free(spacing);
+    free(neighbours);
+    free(tasks);
+
+    return status;
+}
+
+int generate_palette(const char **image_paths, const int count, int workers, uint8_t *palette) {
+    // Count 6-bit colours of every image, with one histogram per thread
+    workers = clamp_workers(workers, count);
+    histogram_task *tasks = calloc(workers, sizeof(histogram_task));
+    for (int i = 0; i < workers; i++) {
+        tasks[i].image_paths = image_paths;
+        tasks[i].count = count;
+        tasks[i].first = i;
+        tasks[i].step = workers;
+        tasks[i].histogram = calloc(COLOUR_COUNT, sizeof(uint64_t));
+        tasks[i].status = 1;
+    }
+    int status = run_tasks(histogram_worker, tasks, sizeof(histogram_task), workers);
+    for (int i = 0; i < workers; i++) {
+        status &= tasks[i].status;
+        for (int j = 0; i > 0 && j < COLOUR_COUNT; j++) {
+            tasks[0].histogram[j] += tasks[i].histogram[j];
+        }
+        if (i > 0) {
+            free(tasks[i].histogram);
+        }
+    }
+    uint64_t *histogram = tasks[0].histogram;
+    free(tasks);
+    if (status != 1) {
+        free(histogram);
+        return 0;
+    }
+
+    // Cluster distinct colours weighted by their pixels, rather than every pixel
+    int entry_count = 0;
+    for (int i = 0; i < COLOUR_COUNT; i++) {
+        entry_count += histogram[i] != 0;
+    }
+    colour_entry *entries = malloc(entry_count * sizeof(colour_entry));
+    entry_count = 0;
+    for (int i = 0; i < COLOUR_COUNT; i++) {
+        if (histogram[i] != 0) {
+            entries[entry_count].red = i >> 12;
+            entries[entry_count].green = (i >> 6) & 63;
+            entries[entry_count].blue = i & 63;
+            entries[entry_count].cluster = 0;
+            entries[entry_count].weight = histogram[i];
+            entry_count++;
+        }
+    }
+    free(histogram);
+    if (entry_count == 0) {
+        free(entries);
+        fprintf(stderr, "No pixels to generate a colour palette from\n");
+        return 0;
+    }
+
+    // Seed clusters by median cut, then refine them by k-means
+    colour_box boxes[256];
+    const int cluster_count = median_cut(entries, entry_count, boxes);
+    float centroids[256 * 3];
+    for (int j = 0; j < cluster_count; j++) {
+        uint64_t sums[3] = {0, 0, 0}, weight = 0;
+        for (int i = boxes[j].start; i < boxes[j].end; i++) {
+            sums[0] += entries[i].red * entries[i].weight;
+            sums[1] += entries[i].green * entries[i].weight;
+            sums[2] += entries[i].blue * entries[i].weight;
+            weight += entries[i].weight;
+            entries[i].cluster = j;
+        }
+        for (int c = 0; c < 3; c++) {
+            centroids[j * 3 + c] = (float) sums[c] / weight;
+        }
+    }
+    const int cluster_status = kmeans(entries, entry_count, centroids, cluster_count, workers);
+    free(entries);
+    if (cluster_status != 1) {
+        return 0;
+    }
+
+    // Round centroids to 6-bit colour values, leaving unused entries black
+    memset(palette, 0, COL_SIZE);
+    for (int i = 0; i < cluster_count * 3; i++) {
+        const int value = (int) (centroids[i] + 0.5f);
+        palette[i] = value > 63 ? 63 : value;
+    }
+
+    return 1;
+}
+
+static void get_remap_path(char *output_path, size_t output_size, const char *output_dir, const char *image_path, int width, int height) {
+    // Name output after the source, in the game format of its size
+    const char *name = strrchr(image_path, '/');
+    name = name != NULL ? name + 1 : image_path;
+    const char *dot = strrchr(name, '.');
+    const int name_length = dot != NULL ? (int) (dot - name) : (int) strlen(name);
+    snprintf(output_path, output_size, "%s/%.*s%s", output_dir, name_length, name, width == 320 && height == 200 ? ".RAW" : ".TM");
+}
+
+static int compare_remap_outputs(const void *a, const void *b) {
+    return strcmp(((const remap_output *) a)->path, ((const remap_output *) b)->path);
+}
+
+int check_remap_images(const char **image_paths, const int count, const char *output_dir) {
+    remap_output *outputs = malloc(count * sizeof(remap_output));
+    if (outputs == NULL) {
+        fprintf(stderr, "Could not allocate output names\n");
+        return 0;
+    }
+
+    // Accept only sizes of a game format, before any pixels are read
+    image_info info;
+    for (int i = 0; i < count; i++) {
+        if (probe_image(image_paths[i], &info) != 1) {
+            free(outputs);
+            fprintf(stderr, "Could not probe %s\n", image_paths[i]);
+            return 0;
+        }
+        if (!(info.width == 256 && info.height == 192) && !(info.width == 320 && info.height == 200)) {
+            free(outputs);
+            fprintf(stderr, "Unsupported image size %ux%u of %s\n", info.width, info.height, image_paths[i]);
+            return 0;
+        }
+        get_remap_path(outputs[i].path, sizeof(outputs[i].path), output_dir, image_paths[i], info.width, info.height);
+        outputs[i].image_path = image_paths[i];
+    }
+
+    // Refuse images that would overwrite each other's output
+    qsort(outputs, count, sizeof(remap_output), compare_remap_outputs);
+    for (int i = 1; i < count; i++) {
+        if (strcmp(outputs[i - 1].path, outputs[i].path) == 0) {
+            fprintf(stderr, "Both %s and %s would be written to %s\n", outputs[i - 1].image_path, outputs[i].image_path, outputs[i].path);
+            free(outputs);
+            return 0;
+        }
+    }
+    free(outputs);
+
+    return 1;
+}
+
+static void *remap_worker(void *argument) {
+    remap_task *task = argument;
+    trace_name_thread("converter");
+    colour_map *map = colour_map_new(task->palette);
+    uint8_t *image_data = malloc(RAW_SIZE - COL_SIZE);
+    if (map == NULL || image_data == NULL) {
+        colour_map_free(map);
+        free(image_data);
+        fprintf(stderr, "Could not create colour map\n");
+        task->status = 0;
+        return NULL;
+    }
+    for (int i = task->first; i < task->count; i += task->step) {
+        const char *image_path = task->image_paths[i];
+        const uint64_t convert_start = trace_begin();
+        int width, height;
+        uint8_t *rgb = load_rgb(image_path, &width, &height);
+        if (rgb == NULL) {
+            fprintf(stderr, "Could not read %s\n", image_path);
+            task->status = 0;
+            trace_end("encode", image_path, convert_start);
+            continue;
+        }
+
+        char output_path[FILENAME_MAX];
+        get_remap_path(output_path, sizeof(output_path), task->output_dir, image_path, width, height);
+
+        // Quantise to the shared palette
+        if (rgb_to_image(map, rgb, width, height, image_data, output_path, task->dither) != 1) {
+            fprintf(stderr, "Could not remap %s\n", image_path);
+            task->status = 0;
+        }
+        free(rgb);
+        trace_end("encode", output_path, convert_start);
+    }
+    colour_map_free(map);
+    free(image_data);
+    return NULL;
+}
+
+int remap_images(const char **image_paths, const int count, int workers, const char *palette_path, const char *output_dir, dither_mode dither) {
+    // Read palette back as it was written, so images match the file exactly
+    uint8_t palette[COL_SIZE];
+    if (read_palette_from_file(palette, palette_path) != 1) {
+        return 0;
+    }
+
+    // Remap images on every thread, each with its own colour map
+    workers = clamp_workers(workers, count);
+    remap_task *tasks = calloc(workers, sizeof(remap_task));
+    for (int i = 0; i < workers; i++) {
+        tasks[i].image_paths = image_paths;
+        tasks[i].count = count;
+        tasks[i].first = i;
+        tasks[i].step = workers;
+        tasks[i].palette = palette;
+        tasks[i].output_dir = output_dir;
+        tasks[i].dither = dither;
+        tasks[i].status = 1;
+    }
+    int status = run_tasks(remap_worker, tasks, sizeof(remap_task), workers);
+    for (int i = 0; i < workers; i++) {
+        status &= tasks[i].status;
+    }
+    free(tasks);
+
+    return status;
+}
@@ -0,0 +1,579 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "pipeline.h"
+#include "image.h"
+#include "uring.h"
+#include "dedup.h"
+#include "cache.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Set compile-time constants
+#define QUEUE_SIZE 128
+#define MAX_INPUT_SIZE (16 * 1024 * 1024)
+#define MAX_WORKERS 64
+#define SPARE_OUTPUTS (2 * QUEUE_SIZE)
+
+typedef struct job {
+    const manifest_entry *entry;
+    uint8_t *input;
+    size_t input_size;
+    uint8_t *palette;
+    size_t palette_size;
+    uint8_t *output;
+    size_t output_capacity;
+    size_t output_size;
+} job;
+
+// Bounded queue connecting two pipeline stages
+typedef struct job_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    job *jobs[QUEUE_SIZE];
+    int head;
+    int count;
+    int producers;
+} job_queue;
+
+typedef struct pipeline {
+    const manifest *list;
+    job_queue convert_queue;
+    job_queue write_queue;
+    pthread_mutex_t failure_mutex;
+    int failures;
+    uint8_t *failed; // Whether each entry failed
+
+    // Output buffers of written jobs, handed to later conversions so warm ones allocate nothing
+    pthread_mutex_t spare_mutex;
+    uint8_t *spares[SPARE_OUTPUTS];
+    size_t spare_capacities[SPARE_OUTPUTS];
+    int spare_count;
+} pipeline;
+
+static void queue_init(job_queue *queue, int producers) {
+    memset(queue, 0, sizeof(*queue));
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->producers = producers;
+}
+
+static void queue_destroy(job_queue *queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+static void queue_push(job_queue *queue, job *item) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == QUEUE_SIZE) {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    queue->jobs[(queue->head + queue->count) % QUEUE_SIZE] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Return next job, waiting for one unless told not to, or NULL once every producer has finished
+static job *queue_pop(job_queue *queue, int wait) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && queue->producers > 0 && wait) {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    job *item = NULL;
+    if (queue->count > 0) {
+        item = queue->jobs[queue->head];
+        queue->head = (queue->head + 1) % QUEUE_SIZE;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+static void queue_finish_producer(job_queue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->producers--;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void fail_entry(pipeline *line, const manifest_entry *entry, const char *message) {
+    fprintf(stderr, "%s: %s\n", entry->destination, message);
+    pthread_mutex_lock(&line->failure_mutex);
+    line->failures++;
+    line->failed[entry - line->list->entries] = 1;
+    pthread_mutex_unlock(&line->failure_mutex);
+}
+
+static void take_spare(pipeline *line, job *item) {
+    pthread_mutex_lock(&line->spare_mutex);
+    if (line->spare_count > 0) {
+        line->spare_count--;
+        item->output = line->spares[line->spare_count];
+        item->output_capacity = line->spare_capacities[line->spare_count];
+    }
+    pthread_mutex_unlock(&line->spare_mutex);
+}
+
+static void release_output(pipeline *line, job *item) {
+    // Keep the buffer for a later conversion, unless enough are spare already
+    pthread_mutex_lock(&line->spare_mutex);
+    if (item->output != NULL && line->spare_count < SPARE_OUTPUTS) {
+        line->spares[line->spare_count] = item->output;
+        line->spare_capacities[line->spare_count] = item->output_capacity;
+        line->spare_count++;
+        item->output = NULL;
+    }
+    pthread_mutex_unlock(&line->spare_mutex);
+    free(item->output);
+    item->output = NULL;
+}
+
+static void fail_job(pipeline *line, job *item, const char *message) {
+    fail_entry(line, item->entry, message);
+    free(item->input);
+    free(item->palette);
+    release_output(line, item);
+    free(item);
+}
+
+static int open_input(const char *path, uint8_t **buffer, size_t *size) {
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+#ifdef _WIN32
+    setmode(fd, O_BINARY);
+#endif
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0 || file_stat.st_size > MAX_INPUT_SIZE) {
+        close(fd);
+        return -1;
+    }
+    *size = file_stat.st_size;
+    *buffer = malloc(*size);
+    if (*buffer == NULL) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Transfer whole buffers for a batch of files, resubmitting short transfers until done
+static int queue_transfer(uring *ring, int is_write, int fd, uint8_t *buffer, size_t size, uint64_t offset, int i) {
+    if (is_write) {
+        return uring_write(ring, fd, buffer, size, offset, i);
+    }
+    return uring_read(ring, fd, buffer, size, offset, i);
+}
+
+// Return 1 once done, 0 on failure, or -1 if the kernel may still be using the buffers
+static int transfer_batch(uring *ring, int is_write, int *fds, uint8_t **buffers, const size_t *sizes, int *results, int count) {
+    size_t *done = calloc(count, sizeof(size_t));
+    if (done == NULL) {
+        return 0;
+    }
+
+    // Only count operations the ring accepted, failing any entry it refused
+    int pending = 0;
+    for (int i = 0; i < count; i++) {
+        results[i] = fds[i] != -1;
+        if (results[i] && sizes[i] > 0) {
+            if (queue_transfer(ring, is_write, fds[i], buffers[i], sizes[i], 0, i) == 1) {
+                pending++;
+            } else {
+                results[i] = 0;
+            }
+        }
+    }
+
+    uring_completion completion;
+    while (pending > 0 && uring_wait(ring, &completion) == 1) {
+        const int i = completion.user_data;
+        pending--;
+        if (completion.result <= 0) {
+            results[i] = 0;
+            continue;
+        }
+        done[i] += completion.result;
+        if (done[i] < sizes[i]) {
+            if (queue_transfer(ring, is_write, fds[i], &buffers[i][done[i]], sizes[i] - done[i], done[i], i) == 1) {
+                pending++;
+            } else {
+                results[i] = 0;
+            }
+        }
+    }
+    free(done);
+
+    // Cancel transfers left behind by a failed wait, so none completes into a later batch
+    if (pending > 0) {
+        return uring_cancel(ring) == 1 ? 0 : -1;
+    }
+    return 1;
+}
+
+// Replace a ring that could not be drained, whose buffers must then never be freed
+static void reset_ring(uring *ring) {
+    fprintf(stderr, "Could not cancel transfers in flight\n");
+    uring_exit(ring);
+    uring_init(ring);
+}
+
+static void *read_stage(void *argument) {
+    pipeline *line = argument;
+    trace_name_thread("reader");
+    uring ring;
+    uring_init(&ring);
+
+    // Each job reads its input and palette, so half the ring is used per batch
+    const int batch_size = URING_ENTRIES / 2;
+    int fds[URING_ENTRIES];
+    uint8_t *buffers[URING_ENTRIES];
+    size_t sizes[URING_ENTRIES];
+    int results[URING_ENTRIES];
+    job *batch[URING_ENTRIES / 2];
+    for (int first = 0; first < line->list->count; first += batch_size) {
+        const int count = line->list->count - first < batch_size ? line->list->count - first : batch_size;
+
+        // Open inputs of the batch
+        const uint64_t read_start = trace_begin();
+        int palette_count = 0;
+        for (int i = 0; i < count; i++) {
+            job *item = calloc(1, sizeof(*item));
+            batch[i] = item;
+            if (item == NULL) {
+                fail_entry(line, &line->list->entries[first + i], "Could not create job");
+                fds[i * 2] = fds[i * 2 + 1] = -1;
+                sizes[i * 2] = sizes[i * 2 + 1] = 0;
+                continue;
+            }
+            item->entry = &line->list->entries[first + i];
+            fds[i * 2] = open_input(item->entry->source, &item->input, &item->input_size);
+            fds[i * 2 + 1] = item->entry->palette != NULL ? open_input(item->entry->palette, &item->palette, &item->palette_size) : -1;
+            buffers[i * 2] = item->input;
+            sizes[i * 2] = item->input_size;
+            buffers[i * 2 + 1] = item->palette;
+            sizes[i * 2 + 1] = item->palette_size;
+            palette_count += item->entry->palette != NULL;
+        }
+
+        // Read whole batch at once
+        const int transfer_status = transfer_batch(&ring, 0, fds, buffers, sizes, results, count * 2);
+        if (transfer_status != 1) {
+            for (int i = 0; i < count * 2; i++) {
+                results[i] = 0;
+            }
+        }
+        if (transfer_status == -1) {
+            // The kernel may still read into the buffers, so leave them allocated
+            for (int i = 0; i < count; i++) {
+                if (batch[i] != NULL) {
+                    batch[i]->input = batch[i]->palette = NULL;
+                }
+            }
+            reset_ring(&ring);
+        }
+
+        if (read_start != 0) {
+            char detail[FILENAME_MAX + 64];
+            snprintf(detail, sizeof(detail), "%d images and %d palettes from %s", count, palette_count, line->list->entries[first].source);
+            trace_end("read", detail, read_start);
+        }
+
+        // Pass read jobs on for conversion
+        for (int i = 0; i < count; i++) {
+            if (fds[i * 2] != -1) {
+                close(fds[i * 2]);
+            }
+            if (fds[i * 2 + 1] != -1) {
+                close(fds[i * 2 + 1]);
+            }
+            if (batch[i] == NULL) {
+                continue;
+            }
+            if (!results[i * 2]) {
+                fail_job(line, batch[i], "Error reading image");
+            } else if (batch[i]->entry->palette != NULL && !results[i * 2 + 1]) {
+                fail_job(line, batch[i], "Error reading colour palette");
+            } else {
+                queue_push(&line->convert_queue, batch[i]);
+            }
+        }
+    }
+
+    uring_exit(&ring);
+    queue_finish_producer(&line->convert_queue);
+    return NULL;
+}
+
+static void *convert_stage(void *argument) {
+    pipeline *line = argument;
+    trace_name_thread("converter");
+
+    // Reuse one set of buffers and codec arenas for every job of this thread
+    convert_context *context = context_new();
+    job *item;
+    while ((item = queue_pop(&line->convert_queue, 1)) != NULL) {
+        if (context == NULL) {
+            fail_job(line, item, "Could not create conversion context");
+            continue;
+        }
+
+        // Gif inputs are encoded, game images are decoded
+        take_spare(line, item);
+        const uint64_t convert_start = trace_begin();
+        alloc_begin();
+        int status;
+        if (item->input_size >= 3 && memcmp(item->input, "GIF", 3) == 0) {
+            status = gif_data_to_image_data(context, item->input, item->input_size, item->palette, item->palette_size, &item->output, &item->output_capacity, &item->output_size);
+            alloc_end(NULL);
+            trace_end("encode", item->entry->destination, convert_start);
+        } else {
+            status = image_data_to_gif_data(context, item->input, item->input_size, item->palette, item->palette_size, &item->output, &item->output_capacity, &item->output_size);
+            alloc_end(NULL);
+            trace_end("decode", item->entry->destination, convert_start);
+        }
+        free(item->input);
+        free(item->palette);
+        item->input = item->palette = NULL;
+        if (status != 1) {
+            fail_job(line, item, "Could not convert image");
+            continue;
+        }
+        queue_push(&line->write_queue, item);
+    }
+    context_free(context);
+    queue_finish_producer(&line->write_queue);
+    return NULL;
+}
+
+static void *write_stage(void *argument) {
+    pipeline *line = argument;
+    trace_name_thread("writer");
+    uring ring;
+    uring_init(&ring);
+
+    int fds[URING_ENTRIES];
+    uint8_t *buffers[URING_ENTRIES];
+    size_t sizes[URING_ENTRIES];
+    int results[URING_ENTRIES];
+    job *batch[URING_ENTRIES];
+    char *temp_paths[URING_ENTRIES];
+    char *commit_temp_paths[URING_ENTRIES];
+    const char *commit_paths[URING_ENTRIES];
+    job *commit_batch[URING_ENTRIES];
+    for (int i = 0; i < URING_ENTRIES; i++) {
+        temp_paths[i] = malloc(FILENAME_MAX);
+    }
+    while (1) {
+        // Wait for one converted job, then take whatever else is ready
+        int count = 0;
+        job *item = queue_pop(&line->write_queue, 1);
+        while (item != NULL) {
+            batch[count++] = item;
+            item = count < URING_ENTRIES ? queue_pop(&line->write_queue, 0) : NULL;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        // Create temporary outputs of the batch, renamed into place once written
+        const uint64_t write_start = trace_begin();
+        for (int i = 0; i < count; i++) {
+            output_temp_path(temp_paths[i], FILENAME_MAX, batch[i]->entry->destination);
+            fds[i] = open(temp_paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#ifdef _WIN32
+            if (fds[i] != -1) {
+                setmode(fds[i], O_BINARY);
+            }
+#endif
+            buffers[i] = batch[i]->output;
+            sizes[i] = batch[i]->output_size;
+        }
+
+        // Write whole batch at once
+        const int transfer_status = transfer_batch(&ring, 1, fds, buffers, sizes, results, count);
+        if (transfer_status != 1) {
+            for (int i = 0; i < count; i++) {
+                results[i] = 0;
+            }
+        }
+        if (transfer_status == -1) {
+            // The kernel may still read from the buffers, so leave them allocated
+            for (int i = 0; i < count; i++) {
+                batch[i]->output = NULL;
+            }
+            reset_ring(&ring);
+        }
+        char detail[FILENAME_MAX + 64];
+        if (write_start != 0) {
+            snprintf(detail, sizeof(detail), "%d images to %s", count, batch[0]->entry->destination);
+        }
+        int commit_count = 0;
+        for (int i = 0; i < count; i++) {
+            if (fds[i] != -1 && close(fds[i]) != 0) {
+                results[i] = 0;
+            }
+            if (!results[i]) {
+                output_abort(temp_paths[i]);
+                fail_job(line, batch[i], "Error writing image data to file");
+                continue;
+            }
+            commit_temp_paths[commit_count] = temp_paths[i];
+            commit_paths[commit_count] = batch[i]->entry->destination;
+            commit_batch[commit_count++] = batch[i];
+        }
+
+        // Sync the written outputs together before renaming them into place
+        output_commit_group(commit_temp_paths, commit_paths, commit_count, results);
+        for (int i = 0; i < commit_count; i++) {
+            if (results[i] != 1) {
+                fail_job(line, commit_batch[i], "Error committing image file");
+                continue;
+            }
+            release_output(line, commit_batch[i]);
+            free(commit_batch[i]);
+        }
+        if (write_start != 0) {
+            trace_end("write", detail, write_start);
+        }
+    }
+
+    for (int i = 0; i < URING_ENTRIES; i++) {
+        free(temp_paths[i]);
+    }
+    uring_exit(&ring);
+    return NULL;
+}
+
+int convert_manifest(const char *manifest_path, int workers, const char *report_path) {
+    // Read manifest
+    manifest *list = manifest_read(manifest_path);
+    if (list == NULL) {
+        return 0;
+    }
+    if (workers < 1) {
+        workers = 1;
+    } else if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+
+    // Convert only the first of entries with identical inputs when deduplicating
+    int *canonical = NULL;
+    manifest unique = *list;
+    if (report_path != NULL) {
+        canonical = dedup_manifest(list);
+        unique.entries = malloc(list->count * sizeof(manifest_entry));
+        unique.count = 0;
+        for (int i = 0; i < list->count; i++) {
+            if (canonical[i] == i) {
+                unique.entries[unique.count++] = list->entries[i];
+            }
+        }
+    }
+
+    // Read, convert and write stages overlap, connected by bounded queues
+    pipeline line;
+    line.list = &unique;
+    line.failures = 0;
+    line.failed = calloc(unique.count > 0 ? unique.count : 1, 1);
+    pthread_mutex_init(&line.failure_mutex, NULL);
+    pthread_mutex_init(&line.spare_mutex, NULL);
+    line.spare_count = 0;
+    queue_init(&line.convert_queue, 1);
+    queue_init(&line.write_queue, workers);
+    // Start each stage before the stage feeding it, so no thread waits on a stage that failed to start
+    pthread_t reader, writer, converters[MAX_WORKERS];
+    const int writer_started = pthread_create(&writer, NULL, write_stage, &line) == 0;
+    int converters_started = 0;
+    while (writer_started && converters_started < workers && pthread_create(&converters[converters_started], NULL, convert_stage, &line) == 0) {
+        converters_started++;
+    }
+    const int reader_started = converters_started == workers && pthread_create(&reader, NULL, read_stage, &line) == 0;
+    if (!reader_started) {
+        // Finish on behalf of stages that never started, so the started ones drain and exit
+        fprintf(stderr, "Error starting conversion threads\n");
+        queue_finish_producer(&line.convert_queue);
+        for (int i = converters_started; i < workers; i++) {
+            queue_finish_producer(&line.write_queue);
+        }
+    }
+
+    // Wait for every stage to drain
+    if (reader_started) {
+        pthread_join(reader, NULL);
+    }
+    for (int i = 0; i < converters_started; i++) {
+        pthread_join(converters[i], NULL);
+    }
+    if (writer_started) {
+        pthread_join(writer, NULL);
+    }
+    queue_destroy(&line.convert_queue);
+    queue_destroy(&line.write_queue);
+    pthread_mutex_destroy(&line.failure_mutex);
+    for (int i = 0; i < line.spare_count; i++) {
+        free(line.spares[i]);
+    }
+    pthread_mutex_destroy(&line.spare_mutex);
+    if (!reader_started) {
+        // Nothing was read, so every entry failed
+        memset(line.failed, 1, unique.count);
+        line.failures = unique.count;
+    }
+
+    // Link each duplicate to the output of its canonical entry
+    if (canonical != NULL) {
+        int *failed = calloc(list->count, sizeof(int));
+        for (int i = 0, unique_index = 0; i < list->count; i++) {
+            if (canonical[i] == i) {
+                failed[i] = line.failed[unique_index++];
+                continue;
+            }
+            const manifest_entry *entry = &list->entries[i];
+            const manifest_entry *canonical_entry = &list->entries[canonical[i]];
+            if (failed[canonical[i]]) {
+                fprintf(stderr, "%s: Duplicate of a failed conversion\n", entry->destination);
+                line.failures++;
+            } else if (strcmp(entry->destination, canonical_entry->destination) != 0) {
+                const uint64_t link_start = trace_begin();
+                if (cache_link(canonical_entry->destination, entry->destination) != 1) {
+                    fprintf(stderr, "%s: Error linking duplicate\n", entry->destination);
+                    line.failures++;
+                }
+                trace_end("link", entry->destination, link_start);
+            }
+        }
+        if (dedup_report(report_path, list, canonical) != 1) {
+            line.failures++;
+        }
+        free(failed);
+        free(canonical);
+        free(unique.entries);
+    }
+    free(line.failed);
+    const int count = list->count;
+    manifest_free(list);
+
+    if (line.failures > 0) {
+        fprintf(stderr, "%d of %d conversions failed\n", line.failures, count);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,141 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "trace.h"
+#include "output.h"
+
+#include <pthread.h>
+#include <time.h>
+
+typedef struct trace_event {
+    const char *name;
+    char *detail; // NULL for thread names
+    int thread;
+    uint64_t start;
+    uint64_t duration;
+} trace_event;
+
+// Chrome trace events recorded so far, or no path if tracing is disabled
+static const char *trace_path = NULL;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_event *events = NULL;
+static int event_count = 0;
+static int event_capacity = 0;
+static int thread_count = 0;
+static _Thread_local int thread_id = 0;
+
+static uint64_t get_microseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void add_event(const char *name, const char *detail, uint64_t start, uint64_t duration) {
+    pthread_mutex_lock(&trace_mutex);
+
+    // Number threads by their first event, so each gets its own track
+    if (thread_id == 0) {
+        thread_id = ++thread_count;
+    }
+    if (event_count == event_capacity) {
+        event_capacity = event_capacity == 0 ? 1024 : event_capacity * 2;
+        events = realloc(events, event_capacity * sizeof(trace_event));
+    }
+    trace_event *event = &events[event_count++];
+    event->name = name;
+    event->detail = NULL;
+    if (detail != NULL) {
+        event->detail = malloc(strlen(detail) + 1);
+        strcpy(event->detail, detail);
+    }
+    event->thread = thread_id;
+    event->start = start;
+    event->duration = duration;
+
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+void trace_start(const char *path) {
+    trace_path = path;
+}
+
+void trace_name_thread(const char *name) {
+    if (trace_path != NULL) {
+        add_event(name, NULL, 0, 0);
+    }
+}
+
+uint64_t trace_begin(void) {
+    return trace_path != NULL ? get_microseconds() : 0;
+}
+
+void trace_end(const char *name, const char *detail, uint64_t start) {
+    if (trace_path != NULL) {
+        add_event(name, detail != NULL ? detail : "", start, get_microseconds() - start);
+    }
+}
+
+static void write_string(FILE *trace_pointer, const char *string) {
+    // Escape quotes, backslashes and control characters
+    fputc('"', trace_pointer);
+    for (const char *c = string; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(trace_pointer, "\\%c", *c);
+        } else if ((unsigned char) *c < 0x20) {
+            fprintf(trace_pointer, "\\u%04x", *c);
+        } else {
+            fputc(*c, trace_pointer);
+        }
+    }
+    fputc('"', trace_pointer);
+}
+
+int trace_finish(void) {
+    const char *path = trace_path;
+    if (path == NULL) {
+        return 1;
+    }
+
+    // Create trace file
+    char temp_path[FILENAME_MAX];
+    output_temp_path(temp_path, sizeof(temp_path), path);
+    FILE *trace_pointer = fopen(temp_path, "w");
+    int write_status = trace_pointer != NULL;
+
+    // Write thread names as metadata, and everything else as complete events
+    if (write_status == 1) {
+        fprintf(trace_pointer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (int i = 0; i < event_count; i++) {
+            const trace_event *event = &events[i];
+            if (event->detail == NULL) {
+                fprintf(trace_pointer, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", event->thread);
+                write_string(trace_pointer, event->name);
+            } else {
+                fprintf(trace_pointer, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu,\"dur\":%llu,\"args\":{\"detail\":", event->name, event->thread, (unsigned long long) event->start, (unsigned long long) event->duration);
+                write_string(trace_pointer, event->detail);
+            }
+            fprintf(trace_pointer, "}}%s\n", i + 1 < event_count ? "," : "");
+        }
+        fprintf(trace_pointer, "]}\n");
+        if (fclose(trace_pointer) != 0) {
+            write_status = 0;
+        }
+    }
+    for (int i = 0; i < event_count; i++) {
+        free(events[i].detail);
+    }
+    free(events);
+    events = NULL;
+    event_count = event_capacity = 0;
+    trace_path = NULL;
+    if (write_status != 1) {
+        output_abort(temp_path);
+        fprintf(stderr, "Error writing trace file\n");
+        return 0;
+    }
+
+    return output_commit(temp_path, path);
+}
@@ -0,0 +1,160 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "transform.h"
+
+#include <errno.h>
+#include <limits.h>
+
+// Side of the square blocks rotated at a time, so source rows of a block stay in cache
+#define BLOCK_SIZE 16
+
+static int parse_crop(const char *text, transform *t) {
+    // Read x,y,width,height as decimal numbers, each within an int
+    int *fields[4] = {&t->x, &t->y, &t->width, &t->height};
+    for (int i = 0; i < 4; i++) {
+        char *end;
+        errno = 0;
+        const long value = strtol(text, &end, 10);
+        if (end == text || errno == ERANGE || value < (i < 2 ? 0 : 1) || value > INT_MAX || *end != (i < 3 ? ',' : '\0')) {
+            fprintf(stderr, "Unsupported crop region\n");
+            return 0;
+        }
+        *fields[i] = (int) value;
+        text = end + 1;
+    }
+    return 1;
+}
+
+int parse_transform(const char *text, transform *t) {
+    memset(t, 0, sizeof(*t));
+    if (strcmp(text, "flip-h") == 0) {
+        t->type = TRANSFORM_FLIP_HORIZONTAL;
+    } else if (strcmp(text, "flip-v") == 0) {
+        t->type = TRANSFORM_FLIP_VERTICAL;
+    } else if (strcmp(text, "rotate-90") == 0) {
+        t->type = TRANSFORM_ROTATE_90;
+    } else if (strcmp(text, "rotate-180") == 0) {
+        t->type = TRANSFORM_ROTATE_180;
+    } else if (strcmp(text, "rotate-270") == 0) {
+        t->type = TRANSFORM_ROTATE_270;
+    } else if (strncmp(text, "crop:", 5) == 0) {
+        t->type = TRANSFORM_CROP;
+        return parse_crop(text + 5, t);
+    } else {
+        fprintf(stderr, "Unknown transform %s\n", text);
+        return 0;
+    }
+    return 1;
+}
+
+static inline uint64_t swap_word(uint64_t word) {
+    // Compilers turn this into a single byte swap instruction
+    word = (word >> 32) | (word << 32);
+    word = ((word & 0xFFFF0000FFFF0000ULL) >> 16) | ((word & 0x0000FFFF0000FFFFULL) << 16);
+    return ((word & 0xFF00FF00FF00FF00ULL) >> 8) | ((word & 0x00FF00FF00FF00FFULL) << 8);
+}
+
+static void reverse_row(uint8_t *destination, const uint8_t *source, const int width) {
+    // Reverse eight pixels at a time, as swapping the bytes of a word reverses them in memory
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        uint64_t word;
+        memcpy(&word, &source[x], 8);
+        word = swap_word(word);
+        memcpy(&destination[width - 8 - x], &word, 8);
+    }
+    for (; x < width; x++) {
+        destination[width - 1 - x] = source[x];
+    }
+}
+
+static void rotate_quarter(uint8_t *destination, const uint8_t *source, const int size, const int clockwise) {
+    // Transpose block by block, reading each source row once per block rather than once per pixel
+    for (int block_y = 0; block_y < size; block_y += BLOCK_SIZE) {
+        for (int block_x = 0; block_x < size; block_x += BLOCK_SIZE) {
+            const int end_y = block_y + BLOCK_SIZE < size ? block_y + BLOCK_SIZE : size;
+            const int end_x = block_x + BLOCK_SIZE < size ? block_x + BLOCK_SIZE : size;
+            for (int y = block_y; y < end_y; y++) {
+                uint8_t *row = &destination[y * size];
+                if (clockwise) {
+                    for (int x = block_x; x < end_x; x++) {
+                        row[x] = source[(size - 1 - x) * size + y];
+                    }
+                } else {
+                    for (int x = block_x; x < end_x; x++) {
+                        row[x] = source[x * size + size - 1 - y];
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void crop_tiled(uint8_t *destination, const uint8_t *source, const int width, const int height, const transform *t) {
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = &destination[y * width];
+
+        // Rows below the first band of tiles repeat a row already written
+        if (y >= t->height) {
+            memcpy(row, &destination[(y - t->height) * width], width);
+            continue;
+        }
+
+        // Repeat the cropped row across the image
+        const uint8_t *region = &source[(t->y + y) * width + t->x];
+        for (int x = 0; x < width; x += t->width) {
+            memcpy(&row[x], region, x + t->width <= width ? t->width : width - x);
+        }
+    }
+}
+
+int transform_pixels(uint8_t *destination, const uint8_t *source, const int width, const int height, const transform *t) {
+    switch (t->type) {
+        case TRANSFORM_FLIP_HORIZONTAL:
+            for (int y = 0; y < height; y++) {
+                reverse_row(&destination[y * width], &source[y * width], width);
+            }
+            break;
+
+        case TRANSFORM_FLIP_VERTICAL:
+            for (int y = 0; y < height; y++) {
+                memcpy(&destination[y * width], &source[(height - 1 - y) * width], width);
+            }
+            break;
+
+        case TRANSFORM_ROTATE_180:
+            for (int y = 0; y < height; y++) {
+                reverse_row(&destination[y * width], &source[(height - 1 - y) * width], width);
+            }
+            break;
+
+        case TRANSFORM_ROTATE_90:
+        case TRANSFORM_ROTATE_270:
+            // Game formats have fixed sizes, so only square images can turn a quarter
+            if (width != height) {
+                fprintf(stderr, "Only square images can be rotated by 90 or 270 degrees\n");
+                return 0;
+            }
+            rotate_quarter(destination, source, width, t->type == TRANSFORM_ROTATE_90);
+            break;
+
+        case TRANSFORM_CROP:
+            // Compare against the room left after the offset, so no sum can overflow
+            if (t->x < 0 || t->y < 0 || t->width < 1 || t->height < 1 || t->x > width || t->y > height || t->width > width - t->x || t->height > height - t->y) {
+                fprintf(stderr, "Crop region is outside the image\n");
+                return 0;
+            }
+            crop_tiled(destination, source, width, height, t);
+            break;
+
+        default:
+            fprintf(stderr, "Unknown transform\n");
+            return 0;
+    }
+
+    return 1;
+}
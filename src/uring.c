@@ -0,0 +1,234 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "uring.h"
+
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+// Set compile-time constants
+#define URING_RETRIES 1000
+
+#ifdef HAVE_IO_URING
+static int setup_ring(uring *ring) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return 0;
+    }
+
+    // Map submission ring, completion ring and submission entries
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        uring_exit(ring);
+        return 0;
+    }
+
+    uint8_t *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *) &sq[params.sq_off.head];
+    ring->sq_tail = (unsigned *) &sq[params.sq_off.tail];
+    ring->sq_mask = (unsigned *) &sq[params.sq_off.ring_mask];
+    ring->sq_array = (unsigned *) &sq[params.sq_off.array];
+    uint8_t *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *) &cq[params.cq_off.head];
+    ring->cq_tail = (unsigned *) &cq[params.cq_off.tail];
+    ring->cq_mask = (unsigned *) &cq[params.cq_off.ring_mask];
+    ring->cqes = &cq[params.cq_off.cqes];
+
+    return 1;
+}
+
+static int queue_entry(uring *ring, int opcode, int fd, const void *buffer, size_t size, uint64_t offset, uint64_t user_data) {
+    // Fill next submission entry
+    const unsigned tail = *ring->sq_tail;
+    const unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *) ring->sqes)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+
+    // Publish entry to the kernel
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return 1;
+}
+#endif
+
+static int run_sync(uring *ring, int is_write, int fd, const void *buffer, size_t size, uint64_t offset, uint64_t user_data) {
+    // Run operation now and hold its completion until waited for
+    int result;
+    if (lseek(fd, offset, SEEK_SET) == -1) {
+        result = -errno;
+    } else if (is_write) {
+        result = write(fd, buffer, size);
+    } else {
+        result = read(fd, (void *) buffer, size);
+    }
+    if (result < 0) {
+        result = -errno;
+    }
+    ring->completions[ring->completed].user_data = user_data;
+    ring->completions[ring->completed].result = result;
+    ring->completed++;
+    ring->in_flight++;
+    return 1;
+}
+
+int uring_init(uring *ring) {
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+#ifdef HAVE_IO_URING
+    // Fall back to synchronous operations if the kernel refuses io_uring
+    setup_ring(ring);
+#endif
+    return 1;
+}
+
+static int queue_operation(uring *ring, int is_write, int fd, const void *buffer, size_t size, uint64_t offset, uint64_t user_data) {
+    // Caller must wait for completions before queueing more than the ring holds
+    if (ring->in_flight + ring->queued >= URING_ENTRIES) {
+        return 0;
+    }
+#ifdef HAVE_IO_URING
+    if (ring->fd != -1) {
+        return queue_entry(ring, is_write ? IORING_OP_WRITE : IORING_OP_READ, fd, buffer, size, offset, user_data);
+    }
+#endif
+    return run_sync(ring, is_write, fd, buffer, size, offset, user_data);
+}
+
+int uring_read(uring *ring, int fd, void *buffer, size_t size, uint64_t offset, uint64_t user_data) {
+    return queue_operation(ring, 0, fd, buffer, size, offset, user_data);
+}
+
+int uring_write(uring *ring, int fd, const void *buffer, size_t size, uint64_t offset, uint64_t user_data) {
+    return queue_operation(ring, 1, fd, buffer, size, offset, user_data);
+}
+
+int uring_wait(uring *ring, uring_completion *completion) {
+    // Return held completions of synchronous operations
+    if (ring->fd == -1) {
+        if (ring->completed == 0) {
+            return 0;
+        }
+        *completion = ring->completions[--ring->completed];
+        ring->in_flight--;
+        return 1;
+    }
+
+#ifdef HAVE_IO_URING
+    if (ring->in_flight + ring->queued == 0) {
+        return 0;
+    }
+
+    // Submit queued entries in one call, waiting for a completion if none are ready
+    unsigned head = *ring->cq_head;
+    const int wait = head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    if (ring->queued > 0 || wait) {
+        int submitted;
+        do {
+            submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        } while (submitted < 0 && errno == EINTR);
+        if (submitted < 0) {
+            return -1;
+        }
+        ring->queued -= submitted;
+        ring->in_flight += submitted;
+    }
+
+    // Reap one completion
+    head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return uring_wait(ring, completion);
+    }
+    const struct io_uring_cqe *cqe = &((struct io_uring_cqe *) ring->cqes)[head & *ring->cq_mask];
+    completion->user_data = cqe->user_data;
+    completion->result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->in_flight--;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Cancel every queued and in-flight operation, waiting until the kernel is done with their buffers
+int uring_cancel(uring *ring) {
+    // Synchronous operations have already finished, so only their completions are dropped
+    if (ring->fd == -1) {
+        ring->in_flight -= ring->completed;
+        ring->completed = 0;
+        return 1;
+    }
+
+#ifdef HAVE_IO_URING
+    // Withdraw entries not yet submitted, which the kernel only reads when entered
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail - ring->queued, __ATOMIC_RELEASE);
+    ring->queued = 0;
+
+#ifdef IORING_ASYNC_CANCEL_ANY
+    // Ask the kernel to cancel everything in flight, which older kernels refuse without harm
+    if (ring->in_flight > 0 && ring->in_flight < URING_ENTRIES) {
+        const unsigned index = *ring->sq_tail & *ring->sq_mask;
+        queue_entry(ring, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, 0, UINT64_MAX);
+        ((struct io_uring_sqe *) ring->sqes)[index].cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    }
+#endif
+
+    // Reap every completion, retrying while the kernel is short of resources
+    int retries = 0;
+    uring_completion completion;
+    while (ring->in_flight + ring->queued > 0) {
+        if (uring_wait(ring, &completion) == 1) {
+            retries = 0;
+        } else if (++retries == URING_RETRIES) {
+            return 0;
+        } else {
+            usleep(1000);
+        }
+    }
+#endif
+    return 1;
+}
+
+void uring_exit(uring *ring) {
+#ifdef HAVE_IO_URING
+    if (ring->fd != -1) {
+        if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED) {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        close(ring->fd);
+    }
+#endif
+    ring->fd = -1;
+}
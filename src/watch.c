@@ -0,0 +1,280 @@
+/*
+ * Red Image
+ * MIT License
+ * Copyright (c) 2020 Jacob Gelling
+ */
+
+#include "watch.h"
+#include "image.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+// Set compile-time constants
+#define DEBOUNCE_MS 150
+#define EVENT_BUFFER_SIZE 16384
+
+#ifdef __linux__
+typedef struct watcher {
+    const char *source_dir;
+    const char *output_dir;
+    const char *palette_path;
+    const char *palette_name;
+    watch_converter convert;
+
+    // Names changed since the last conversion, without repeats
+    char **pending;
+    int pending_count;
+    int pending_capacity;
+} watcher;
+
+static int has_extension(const char *name, const char *extension) {
+    // Compare extension case-insensitively
+    const char *dot = strrchr(name, '.');
+    if (dot == NULL || strlen(dot) != strlen(extension)) {
+        return 0;
+    }
+    for (int i = 0; dot[i] != '\0'; i++) {
+        const char c = dot[i] >= 'A' && dot[i] <= 'Z' ? dot[i] - 'A' + 'a' : dot[i];
+        if (c != extension[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_convertible(const char *name) {
+    // Skip hidden and backup files that editors write while saving
+    if (name[0] == '.' || name[strlen(name) - 1] == '~') {
+        return 0;
+    }
+    return has_extension(name, ".tm") || has_extension(name, ".raw") || has_extension(name, ".mph") || has_extension(name, ".col") || has_extension(name, ".gif") || has_extension(name, ".ppm");
+}
+
+static const char *get_base_name(const char *path) {
+    const char *separator = strrchr(path, '/');
+    return separator != NULL ? separator + 1 : path;
+}
+
+static void add_pending(watcher *w, const char *name) {
+    for (int i = 0; i < w->pending_count; i++) {
+        if (strcmp(w->pending[i], name) == 0) {
+            return;
+        }
+    }
+    if (w->pending_count == w->pending_capacity) {
+        w->pending_capacity = w->pending_capacity == 0 ? 64 : w->pending_capacity * 2;
+        w->pending = realloc(w->pending, w->pending_capacity * sizeof(char *));
+    }
+    w->pending[w->pending_count] = malloc(strlen(name) + 1);
+    strcpy(w->pending[w->pending_count], name);
+    w->pending_count++;
+}
+
+// Work out mode, output path and palette of a source, returning 0 if it is not convertible
+static int plan_conversion(const watcher *w, const char *input_path, const char *name, char *mode, char *output_path, size_t output_size, const char **palette_path) {
+    // Use the same header-based type detection as conversions
+    image_info info;
+    if (probe_image(input_path, &info) != 1) {
+        return 0;
+    }
+
+    // Gif and true-colour sources are encoded into the game format of their size
+    const char *extension = ".gif";
+    *mode = 'd';
+    if (strcmp(info.type, "GIF") == 0 || strcmp(info.type, "PPM") == 0) {
+        *mode = 'e';
+        const uint32_t size = (uint32_t) info.width * info.height;
+        if (size == 256 && info.type[0] == 'G') {
+            extension = ".COL";
+        } else if (size == TM_SIZE) {
+            extension = ".TM";
+        } else if (size == RAW_SIZE - COL_SIZE) {
+            extension = ".RAW";
+        } else if (size == MPH_SIZE && info.type[0] == 'G') {
+            extension = ".MPH";
+        } else {
+            fprintf(stderr, "%s: Unsupported image size\n", name);
+            return 0;
+        }
+    }
+
+    // .TM images, and anything encoded into one or from true colour, take the palette
+    const int needs_palette = strcmp(info.type, "TM") == 0 || strcmp(extension, ".TM") == 0 || strcmp(info.type, "PPM") == 0;
+    *palette_path = needs_palette ? w->palette_path : NULL;
+    if (needs_palette && w->palette_path == NULL) {
+        fprintf(stderr, "%s: A colour palette is required\n", name);
+        return 0;
+    }
+
+    // Name output after the source
+    const char *dot = strrchr(name, '.');
+    snprintf(output_path, output_size, "%s/%.*s%s", w->output_dir, (int) (dot - name), name, extension);
+
+    return 1;
+}
+
+static int convert_pending(watcher *w, int only_stale) {
+    int status = 1;
+    for (int i = 0; i < w->pending_count; i++) {
+        const char *name = w->pending[i];
+        char input_path[FILENAME_MAX];
+        char output_path[FILENAME_MAX];
+        const char *palette_path;
+        char mode;
+        snprintf(input_path, sizeof(input_path), "%s/%s", w->source_dir, name);
+        if (plan_conversion(w, input_path, name, &mode, output_path, sizeof(output_path), &palette_path) != 1) {
+            status = 0;
+            continue;
+        }
+
+        // Skip outputs newer than their inputs
+        struct stat input_stat, output_stat, palette_stat;
+        if (only_stale && stat(input_path, &input_stat) == 0 && stat(output_path, &output_stat) == 0 && output_stat.st_mtime >= input_stat.st_mtime && (palette_path == NULL || (stat(palette_path, &palette_stat) == 0 && output_stat.st_mtime >= palette_stat.st_mtime))) {
+            continue;
+        }
+
+        if (w->convert(mode, input_path, palette_path, output_path) == 1) {
+            printf("%s -> %s\n", input_path, output_path);
+        } else {
+            status = 0;
+        }
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < w->pending_count; i++) {
+        free(w->pending[i]);
+    }
+    w->pending_count = 0;
+    output_sync();
+
+    return status;
+}
+
+static void add_folder(watcher *w, int palette_only) {
+    DIR *dir = opendir(w->source_dir);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_convertible(entry->d_name)) {
+            continue;
+        }
+
+        // When only palette users are wanted, probe to find .TM images and .TM-sized sources
+        if (palette_only) {
+            char input_path[FILENAME_MAX];
+            image_info info;
+            snprintf(input_path, sizeof(input_path), "%s/%s", w->source_dir, entry->d_name);
+            if (probe_image(input_path, &info) != 1 || (strcmp(info.type, "PPM") != 0 && (uint32_t) info.width * info.height != TM_SIZE)) {
+                continue;
+            }
+        }
+        add_pending(w, entry->d_name);
+    }
+    closedir(dir);
+}
+#endif
+
+int watch_folder(const char *source_dir, const char *output_dir, const char *palette_path, watch_converter convert) {
+#ifdef __linux__
+    // Outputs in the source folder would be converted back again
+    struct stat source_stat, output_stat;
+    if (stat(source_dir, &source_stat) != 0 || !S_ISDIR(source_stat.st_mode)) {
+        fprintf(stderr, "Error opening source folder\n");
+        return 0;
+    }
+    if (stat(output_dir, &output_stat) != 0 || !S_ISDIR(output_stat.st_mode)) {
+        fprintf(stderr, "Error opening output folder\n");
+        return 0;
+    }
+    if (source_stat.st_dev == output_stat.st_dev && source_stat.st_ino == output_stat.st_ino) {
+        fprintf(stderr, "Source and output folders must differ\n");
+        return 0;
+    }
+
+    // Watch for files finished writing or renamed into place by editors
+    const int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Error creating inotify instance\n");
+        return 0;
+    }
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    const int source_wd = inotify_add_watch(fd, source_dir, mask);
+    int palette_wd = -1;
+    if (palette_path != NULL) {
+        // Inotify returns the same watch when the palette is in the source folder
+        char palette_dir[FILENAME_MAX] = ".";
+        const char *palette_name = get_base_name(palette_path);
+        if (palette_name != palette_path) {
+            snprintf(palette_dir, sizeof(palette_dir), "%.*s", (int) (palette_name - palette_path), palette_path);
+        }
+        palette_wd = inotify_add_watch(fd, palette_dir, mask);
+    }
+    if (source_wd == -1 || (palette_path != NULL && palette_wd == -1)) {
+        close(fd);
+        fprintf(stderr, "Error watching folder\n");
+        return 0;
+    }
+
+    // Bring outputs up to date before waiting for changes
+    watcher w = {source_dir, output_dir, palette_path, palette_path != NULL ? get_base_name(palette_path) : NULL, convert, NULL, 0, 0};
+    add_folder(&w, 0);
+    convert_pending(&w, 1);
+    printf("Watching %s\n", source_dir);
+    fflush(stdout);
+
+    // Run until interrupted
+    uint8_t *buffer = malloc(EVENT_BUFFER_SIZE);
+    struct pollfd poll_fd = {fd, POLLIN, 0};
+    int status = 1;
+    while (poll(&poll_fd, 1, -1) > 0) {
+        // Coalesce a burst of events, until none arrive for the debounce time
+        int palette_changed = 0;
+        do {
+            const ssize_t length = read(fd, buffer, EVENT_BUFFER_SIZE);
+            if (length <= 0) {
+                status = 0;
+                break;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const struct inotify_event *event = (const struct inotify_event *) &buffer[offset];
+                offset += sizeof(struct inotify_event) + event->len;
+                if (event->len == 0) {
+                    continue;
+                }
+                if (event->wd == palette_wd && strcmp(event->name, w.palette_name) == 0) {
+                    palette_changed = 1;
+                }
+                if (event->wd == source_wd && is_convertible(event->name)) {
+                    add_pending(&w, event->name);
+                }
+            }
+        } while (status == 1 && poll(&poll_fd, 1, DEBOUNCE_MS) > 0);
+        if (status != 1) {
+            break;
+        }
+
+        // A new palette changes every image that uses it
+        if (palette_changed) {
+            add_folder(&w, 1);
+        }
+        convert_pending(&w, 0);
+    }
+    free(buffer);
+    free(w.pending);
+    close(fd);
+    fprintf(stderr, "Stopped watching %s\n", source_dir);
+
+    return 0;
+#else
+    fprintf(stderr, "Watch mode requires inotify\n");
+    return 0;
+#endif
+}